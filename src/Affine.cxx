@@ -0,0 +1,312 @@
+/*
+Copyright (c) 2024 Joe Davisson.
+
+This file is part of Rendera.
+
+Rendera is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+Rendera is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Rendera; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+*/
+
+#include <algorithm>
+#include <cmath>
+#include <stdint.h>
+
+#include "Affine.H"
+#include "Bitmap.H"
+#include "Gamma.H"
+#include "Gui.H"
+#include "Inline.H"
+#include "Threads.H"
+
+namespace
+{
+  // Reads the clipping area of a bitmap at 16.16 fixed point positions.
+  // Anything outside is transparent. Colors are mixed in linear light,
+  // weighted by alpha, so transparent neighbors don't darken edges.
+  struct Sampler
+  {
+    Bitmap *bmp;
+
+    int fetch(const int x, const int y) const
+    {
+      if (x < bmp->cl || x > bmp->cr || y < bmp->ct || y > bmp->cb)
+        return 0;
+
+      return *(bmp->row[y] + x);
+    }
+
+    int nearest(const int64_t u, const int64_t v) const
+    {
+      return fetch((int)(u >> 16), (int)(v >> 16));
+    }
+
+    // sums of weighted taps
+    struct sum_type
+    {
+      float r, g, b, a;
+
+      void add(const int c, const float weight)
+      {
+        const rgba_type rgba = getRgba(c);
+        const float wa = weight * rgba.a;
+
+        r += Gamma::fix(rgba.r) * wa;
+        g += Gamma::fix(rgba.g) * wa;
+        b += Gamma::fix(rgba.b) * wa;
+        a += wa;
+      }
+
+      int color() const
+      {
+        if (a <= 0)
+          return 0;
+
+        return makeRgba(Gamma::unfix(clamp((int)(r / a + 0.5f), 65535)),
+                        Gamma::unfix(clamp((int)(g / a + 0.5f), 65535)),
+                        Gamma::unfix(clamp((int)(b / a + 0.5f), 65535)),
+                        clamp((int)(a + 0.5f), 255));
+      }
+    };
+
+    int bilinear(int64_t u, int64_t v) const
+    {
+      // taps are centered on pixels
+      u -= 32768;
+      v -= 32768;
+
+      const int x = (int)(u >> 16);
+      const int y = (int)(v >> 16);
+      const float fx = (u & 65535) / 65536.0f;
+      const float fy = (v & 65535) / 65536.0f;
+
+      sum_type sum = { 0, 0, 0, 0 };
+
+      sum.add(fetch(x, y), (1 - fx) * (1 - fy));
+      sum.add(fetch(x + 1, y), fx * (1 - fy));
+      sum.add(fetch(x, y + 1), (1 - fx) * fy);
+      sum.add(fetch(x + 1, y + 1), fx * fy);
+
+      return sum.color();
+    }
+
+    // Catmull-Rom weights for the four taps around a fraction
+    static void cubic(const float t, float *weight)
+    {
+      const float t2 = t * t;
+      const float t3 = t2 * t;
+
+      weight[0] = 0.5f * (-t3 + 2 * t2 - t);
+      weight[1] = 0.5f * (3 * t3 - 5 * t2 + 2);
+      weight[2] = 0.5f * (-3 * t3 + 4 * t2 + t);
+      weight[3] = 0.5f * (t3 - t2);
+    }
+
+    int bicubic(int64_t u, int64_t v) const
+    {
+      u -= 32768;
+      v -= 32768;
+
+      const int x = (int)(u >> 16);
+      const int y = (int)(v >> 16);
+      float wx[4];
+      float wy[4];
+
+      cubic((u & 65535) / 65536.0f, wx);
+      cubic((v & 65535) / 65536.0f, wy);
+
+      sum_type sum = { 0, 0, 0, 0 };
+
+      for (int j = 0; j < 4; j++)
+      {
+        for (int i = 0; i < 4; i++)
+          sum.add(fetch(x + i - 1, y + j - 1), wx[i] * wy[j]);
+      }
+
+      return sum.color();
+    }
+  };
+}
+
+Affine::Affine()
+{
+  a = 1;
+  b = 0;
+  c = 0;
+  d = 0;
+  e = 1;
+  f = 0;
+}
+
+Affine::~Affine()
+{
+}
+
+void Affine::translate(const double x, const double y)
+{
+  c += x;
+  f += y;
+}
+
+void Affine::scale(const double x, const double y)
+{
+  a *= x;
+  b *= x;
+  c *= x;
+  d *= y;
+  e *= y;
+  f *= y;
+}
+
+// angle in degrees, clockwise on screen
+void Affine::rotate(const double angle)
+{
+  const double s = std::sin(angle * (M_PI / 180));
+  const double t = std::cos(angle * (M_PI / 180));
+  const double na = a * t - d * s;
+  const double nb = b * t - e * s;
+  const double nc = c * t - f * s;
+  const double nd = a * s + d * t;
+  const double ne = b * s + e * t;
+  const double nf = c * s + f * t;
+
+  a = na;
+  b = nb;
+  c = nc;
+  d = nd;
+  e = ne;
+  f = nf;
+}
+
+// returns false if the transform flattens everything onto a line
+bool Affine::invert(Affine *dest) const
+{
+  const double det = a * e - b * d;
+
+  if (std::fabs(det) < 1e-12)
+    return false;
+
+  dest->a = e / det;
+  dest->b = -b / det;
+  dest->c = (b * f - c * e) / det;
+  dest->d = -d / det;
+  dest->e = a / det;
+  dest->f = (c * d - a * f) / det;
+
+  return true;
+}
+
+void Affine::map(const double x, const double y, double *xx, double *yy) const
+{
+  *xx = x * a + y * b + c;
+  *yy = x * d + y * e + f;
+}
+
+// pixels covered by the rectangle x1, y1 to x2, y2 (pixel edges) once
+// it's transformed
+void Affine::bounds(const int x1, const int y1, const int x2, const int y2,
+                    int *bx1, int *by1, int *bx2, int *by2) const
+{
+  double x[4];
+  double y[4];
+
+  map(x1, y1, &x[0], &y[0]);
+  map(x2, y1, &x[1], &y[1]);
+  map(x1, y2, &x[2], &y[2]);
+  map(x2, y2, &x[3], &y[3]);
+
+  *bx1 = (int)std::floor(*std::min_element(x, x + 4) + 1e-6);
+  *by1 = (int)std::floor(*std::min_element(y, y + 4) + 1e-6);
+  *bx2 = (int)std::ceil(*std::max_element(x, x + 4) - 1e-6) - 1;
+  *by2 = (int)std::ceil(*std::max_element(y, y + 4) - 1e-6) - 1;
+}
+
+// Fills the clipping area of dest with the transformed clipping area of
+// src, returns -1 if cancelled. The output is walked in square tiles so
+// source reads stay close together at any angle. Each row of a tile
+// starts from an exact position, then steps in fixed point.
+int Affine::apply(Bitmap *src, Bitmap *dest, const int filter,
+                  const bool show_progress) const
+{
+  Affine inverse;
+
+  if (invert(&inverse) == false)
+  {
+    dest->rectfill(dest->cl, dest->ct, dest->cr, dest->cb, 0, 0);
+    return 0;
+  }
+
+  const Sampler sampler = { src };
+  const int tile = 64;
+  const int tiles_x = (dest->cw + tile - 1) / tile;
+  const int64_t du = std::llround(inverse.a * 65536);
+  const int64_t dv = std::llround(inverse.d * 65536);
+
+  if (show_progress)
+    Gui::progressShow(dest->ch);
+
+  for (int y1 = dest->ct; y1 <= dest->cb; y1 += tile)
+  {
+    const int y2 = std::min(y1 + tile - 1, dest->cb);
+
+    Threads::run(0, tiles_x - 1, [&](int, int first, int last)
+    {
+      for (int t = first; t <= last; t++)
+      {
+        const int x1 = dest->cl + t * tile;
+        const int x2 = std::min(x1 + tile - 1, dest->cr);
+
+        for (int y = y1; y <= y2; y++)
+        {
+          double uu, vv;
+
+          inverse.map(x1 + 0.5, y + 0.5, &uu, &vv);
+
+          int64_t u = std::llround(uu * 65536);
+          int64_t v = std::llround(vv * 65536);
+          int *p = dest->row[y] + x1;
+
+          switch (filter)
+          {
+            case NEAREST:
+              for (int x = x1; x <= x2; x++, u += du, v += dv)
+                *p++ = sampler.nearest(u, v);
+              break;
+            case BILINEAR:
+              for (int x = x1; x <= x2; x++, u += du, v += dv)
+                *p++ = sampler.bilinear(u, v);
+              break;
+            default:
+              for (int x = x1; x <= x2; x++, u += du, v += dv)
+                *p++ = sampler.bicubic(u, v);
+              break;
+          }
+        }
+      }
+    });
+
+    if (show_progress)
+    {
+      for (int y = y1; y <= y2; y++)
+      {
+        if (Gui::progressUpdate(y - dest->ct) < 0)
+          return -1;
+      }
+    }
+  }
+
+  if (show_progress)
+    Gui::progressHide();
+
+  return 0;
+}
@@ -35,6 +35,7 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
 #include "Palette.H"
 #include "Project.H"
 #include "Stroke.H"
+#include "Threads.H"
 #include "Tool.H"
 #include "View.H"
 
@@ -943,50 +944,67 @@ void Bitmap::pointStretchIndexed(Bitmap *dest, Palette *pal,
 
 void Bitmap::flipHorizontal()
 {
-  for (int y = 0; y < h; y++)
+  Threads::run(0, h - 1, [&](int, int first, int last)
   {
-    for (int x = 0; x < w / 2; x++)
-    {
-      const int temp = *(row[y] + x);
-      *(row[y] + x) = *(row[y] + w - 1 - x);
-      *(row[y] + w - 1 - x) = temp;
-    }
-  }
+    for (int y = first; y <= last; y++)
+      std::reverse(row[y], row[y] + w);
+  });
 }
 
+// swaps whole rows, pixel data stays in row order for saving and undo
 void Bitmap::flipVertical()
 {
-  for (int y = 0; y < h / 2; y++)
+  Threads::run(0, h / 2 - 1, [&](int, int first, int last)
   {
-    for (int x = 0; x < w; x++)
+    for (int y = first; y <= last; y++)
+      std::swap_ranges(row[y], row[y] + w, row[h - 1 - y]);
+  });
+}
+
+// each row trades places with its mirror, reversed
+void Bitmap::rotate180()
+{
+  Threads::run(0, h / 2 - 1, [&](int, int first, int last)
+  {
+    for (int y = first; y <= last; y++)
     {
-      const int temp = *(row[y] + x);
-      *(row[y] + x) = *(row[h - 1 - y] + x);
-      *(row[h - 1 - y] + x) = temp;
+      std::swap_ranges(row[y], row[y] + w, row[h - 1 - y]);
+      std::reverse(row[y], row[y] + w);
+      std::reverse(row[h - 1 - y], row[h - 1 - y] + w);
     }
-  }
+  });
+
+  if (h & 1)
+    std::reverse(row[h / 2], row[h / 2] + w);
 }
 
-void Bitmap::rotate180()
+// Writes the image turned clockwise into dest, which must be h by w.
+// Done in square tiles so both the rows read and the columns written
+// stay in cache.
+void Bitmap::rotate90(Bitmap *dest)
 {
-  const int size = (w * h) / 2;
-  int count = 0;
+  const int tile = 64;
 
-  for (int y = 0; y < h; y++)
+  Threads::run(0, (h - 1) / tile, [&](int, int first, int last)
   {
-    for (int x = 0; x < w; x++)
+    for (int y1 = first * tile; y1 <= last * tile; y1 += tile)
     {
-      const int temp = *(row[y] + x);
-      *(row[y] + x) = *(row[h - 1 - y] + w - 1 - x);
-      *(row[h - 1 - y] + w - 1 - x) = temp;
-      count++;
-      if (count >= size)
-        break; 
-    }
+      const int y2 = std::min(y1 + tile, h);
 
-    if (count >= size)
-      break; 
-  }
+      for (int x1 = 0; x1 < w; x1 += tile)
+      {
+        const int x2 = std::min(x1 + tile, w);
+
+        for (int x = x1; x < x2; x++)
+        {
+          int *d = dest->row[x] + h - 1 - y1;
+
+          for (int y = y1; y < y2; y++)
+            *d-- = *(row[y] + x);
+        }
+      }
+    }
+  });
 }
 
 void Bitmap::invert()
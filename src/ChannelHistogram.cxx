@@ -0,0 +1,183 @@
+/*
+Copyright (c) 2024 Joe Davisson.
+
+This file is part of Rendera.
+
+Rendera is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+Rendera is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Rendera; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+*/
+
+#include <algorithm>
+#include <vector>
+
+#include "Bitmap.H"
+#include "Blend.H"
+#include "ChannelHistogram.H"
+#include "ColorLut.H"
+#include "Inline.H"
+#include "Threads.H"
+
+ChannelHistogram::ChannelHistogram()
+{
+  total = 0;
+
+  for (int i = 0; i < CHANNELS; i++)
+    std::fill(count[i], count[i] + 256, 0);
+}
+
+ChannelHistogram::~ChannelHistogram()
+{
+}
+
+// saturation takes an HSV conversion per pixel, so it's only counted
+// when asked for
+void ChannelHistogram::build(Bitmap *bmp, const bool saturation)
+{
+  ColorLut identity;
+
+  build(bmp, saturation, identity);
+}
+
+// counts the colors of the selection after passing them through input,
+// so the statistics can follow other color changes in a Chain
+void ChannelHistogram::build(Bitmap *bmp, const bool saturation,
+                             const ColorLut &input)
+{
+  const int bands = Threads::count();
+  std::vector<int> counts(bands * CHANNELS * 256, 0);
+
+  Threads::run(bmp->ct, bmp->cb, [&](int band, int first, int last)
+  {
+    int *red = &counts[(band * CHANNELS + RED) * 256];
+    int *green = &counts[(band * CHANNELS + GREEN) * 256];
+    int *blue = &counts[(band * CHANNELS + BLUE) * 256];
+    int *lum = &counts[(band * CHANNELS + LUMINOSITY) * 256];
+    int *sat = &counts[(band * CHANNELS + SATURATION) * 256];
+
+    for (int y = first; y <= last; y++)
+    {
+      const int *p = bmp->row[y] + bmp->cl;
+
+      for (int x = bmp->cl; x <= bmp->cr; x++)
+      {
+        const rgba_type rgba = getRgba(input.lookup(*p));
+
+        red[rgba.r]++;
+        green[rgba.g]++;
+        blue[rgba.b]++;
+        lum[getlUnpacked(rgba.r, rgba.g, rgba.b)]++;
+
+        if (saturation)
+        {
+          int h, s, v;
+
+          Blend::rgbToHsv(rgba.r, rgba.g, rgba.b, &h, &s, &v);
+          sat[s]++;
+        }
+
+        p++;
+      }
+    }
+  });
+
+  total = bmp->cw * bmp->ch;
+
+  for (int i = 0; i < CHANNELS; i++)
+  {
+    std::fill(count[i], count[i] + 256, 0);
+
+    for (int band = 0; band < bands; band++)
+    {
+      const int *c = &counts[(band * CHANNELS + i) * 256];
+
+      for (int j = 0; j < 256; j++)
+        count[i][j] += c[j];
+    }
+  }
+}
+
+// lowest value present, 255 if none are
+int ChannelHistogram::low(const int channel) const
+{
+  for (int i = 0; i < 256; i++)
+  {
+    if (count[channel][i])
+      return i;
+  }
+
+  return 255;
+}
+
+// highest value present, 0 if none are
+int ChannelHistogram::high(const int channel) const
+{
+  for (int i = 255; i >= 0; i--)
+  {
+    if (count[channel][i])
+      return i;
+  }
+
+  return 0;
+}
+
+// largest count, for scaling a graph
+int ChannelHistogram::peak(const int channel) const
+{
+  return *std::max_element(count[channel], count[channel] + 256);
+}
+
+double ChannelHistogram::mean(const int channel) const
+{
+  if (total == 0)
+    return 0;
+
+  double sum = 0;
+
+  for (int i = 0; i < 256; i++)
+    sum += (double)i * count[channel][i];
+
+  return sum / total;
+}
+
+// number of pixels at or below each value
+std::vector<int> ChannelHistogram::cumulative(const int channel) const
+{
+  std::vector<int> sum(256);
+  int n = 0;
+
+  for (int i = 0; i < 256; i++)
+  {
+    n += count[channel][i];
+    sum[i] = n;
+  }
+
+  return sum;
+}
+
+// draws one channel as a bar graph filling the bitmap
+void ChannelHistogram::draw(Bitmap *dest, const int channel,
+                            const int color) const
+{
+  const int max = std::max(peak(channel), 1);
+
+  for (int x = 0; x < dest->w; x++)
+  {
+    const int i = x * 256 / dest->w;
+    const int height = (int)((double)count[channel][i] * dest->h / max);
+
+    if (height > 0)
+      dest->vline(dest->h - height, x, dest->h - 1, color, 0);
+  }
+}
+
@@ -0,0 +1,252 @@
+/*
+Copyright (c) 2024 Joe Davisson.
+
+This file is part of Rendera.
+
+Rendera is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+Rendera is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Rendera; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+*/
+
+#include <algorithm>
+#include <vector>
+
+#include "Bitmap.H"
+#include "ColorLut.H"
+#include "Gui.H"
+#include "Inline.H"
+#include "Threads.H"
+
+namespace
+{
+  // grid points are every fourth value plus 255, so every input falls
+  // into a cell with corners that were evaluated exactly
+  const int points = 65;
+
+  inline int gridValue(const int i)
+  {
+    return i < points - 1 ? i * 4 : 255;
+  }
+
+  // weights add up to 256
+  inline int interpolate(const int c0, const int c1,
+                         const int c2, const int c3,
+                         const int w0, const int w1,
+                         const int w2, const int w3, const int a)
+  {
+    const rgba_type rgba0 = getRgba(c0);
+    const rgba_type rgba1 = getRgba(c1);
+    const rgba_type rgba2 = getRgba(c2);
+    const rgba_type rgba3 = getRgba(c3);
+
+    return makeRgba((w0 * rgba0.r + w1 * rgba1.r +
+                     w2 * rgba2.r + w3 * rgba3.r + 128) >> 8,
+                    (w0 * rgba0.g + w1 * rgba1.g +
+                     w2 * rgba2.g + w3 * rgba3.g + 128) >> 8,
+                    (w0 * rgba0.b + w1 * rgba1.b +
+                     w2 * rgba2.b + w3 * rgba3.b + 128) >> 8, a);
+  }
+}
+
+ColorLut::ColorLut()
+{
+  separable = true;
+
+  for (int i = 0; i < 256; i++)
+  {
+    if (i < 252)
+    {
+      base[i] = i / 4;
+      frac[i] = (i & 3) * 64;
+    }
+      else
+    {
+      base[i] = points - 2;
+      frac[i] = ((i - 252) * 256) / 3;
+    }
+  }
+
+  for (int i = 0; i < 3; i++)
+  {
+    table[i].resize(256);
+
+    for (int j = 0; j < 256; j++)
+      table[i][j] = j;
+  }
+}
+
+ColorLut::~ColorLut()
+{
+}
+
+// func takes red, green and blue and returns a packed color
+void ColorLut::compile(std::function<int (int, int, int)> func)
+{
+  separable = false;
+  grid.resize(points * points * points);
+
+  Threads::run(0, points - 1, [&](int, int first, int last)
+  {
+    for (int r = first; r <= last; r++)
+    {
+      int *p = &grid[r * points * points];
+
+      for (int g = 0; g < points; g++)
+      {
+        for (int b = 0; b < points; b++)
+        {
+          *p++ = func(gridValue(r), gridValue(g), gridValue(b));
+        }
+      }
+    }
+  });
+}
+
+// func takes a channel (0 = red, 1 = green, 2 = blue) and its value
+void ColorLut::compileChannels(std::function<int (int, int)> func)
+{
+  separable = true;
+  grid.clear();
+
+  for (int i = 0; i < 3; i++)
+  {
+    for (int j = 0; j < 256; j++)
+      table[i][j] = clamp(func(i, j), 255);
+  }
+}
+
+// makes this table do the first one, then the second (neither may be
+// this table)
+void ColorLut::compose(const ColorLut &first, const ColorLut &second)
+{
+  if (first.separable && second.separable)
+  {
+    separable = true;
+    grid.clear();
+
+    for (int i = 0; i < 3; i++)
+    {
+      for (int j = 0; j < 256; j++)
+        table[i][j] = second.table[i][first.table[i][j]];
+    }
+  }
+    else
+  {
+    compile([&](int r, int g, int b)
+    {
+      return second.lookup(first.lookup(makeRgb(r, g, b)));
+    });
+  }
+}
+
+int ColorLut::lookup(const int c) const
+{
+  const rgba_type rgba = getRgba(c);
+
+  if (separable)
+  {
+    return makeRgba(table[0][rgba.r], table[1][rgba.g],
+                    table[2][rgba.b], rgba.a);
+  }
+
+  const int fr = frac[rgba.r];
+  const int fg = frac[rgba.g];
+  const int fb = frac[rgba.b];
+
+  const int sr = points * points;
+  const int sg = points;
+  const int sb = 1;
+
+  const int *p = &grid[base[rgba.r] * sr + base[rgba.g] * sg + base[rgba.b]];
+
+  // pick one of the six tetrahedra in the cell
+  if (fr >= fg)
+  {
+    if (fg >= fb)
+    {
+      return interpolate(p[0], p[sr], p[sr + sg], p[sr + sg + sb],
+                         256 - fr, fr - fg, fg - fb, fb, rgba.a);
+    }
+      else if (fr >= fb)
+    {
+      return interpolate(p[0], p[sr], p[sr + sb], p[sr + sg + sb],
+                         256 - fr, fr - fb, fb - fg, fg, rgba.a);
+    }
+      else
+    {
+      return interpolate(p[0], p[sb], p[sr + sb], p[sr + sg + sb],
+                         256 - fb, fb - fr, fr - fg, fg, rgba.a);
+    }
+  }
+    else
+  {
+    if (fb >= fg)
+    {
+      return interpolate(p[0], p[sb], p[sg + sb], p[sr + sg + sb],
+                         256 - fb, fb - fg, fg - fr, fr, rgba.a);
+    }
+      else if (fb >= fr)
+    {
+      return interpolate(p[0], p[sg], p[sg + sb], p[sr + sg + sb],
+                         256 - fg, fg - fb, fb - fr, fr, rgba.a);
+    }
+      else
+    {
+      return interpolate(p[0], p[sg], p[sr + sg], p[sr + sg + sb],
+                         256 - fg, fg - fr, fr - fb, fb, rgba.a);
+    }
+  }
+}
+
+// transforms the clipping area, rows split across threads, returns -1
+// if cancelled
+int ColorLut::apply(Bitmap *bmp, const bool show_progress)
+{
+  const int batch = 256;
+
+  if (show_progress)
+    Gui::progressShow(bmp->h);
+
+  for (int y1 = bmp->ct; y1 <= bmp->cb; y1 += batch)
+  {
+    const int y2 = std::min(y1 + batch - 1, bmp->cb);
+
+    Threads::run(y1, y2, [&](int, int first, int last)
+    {
+      for (int y = first; y <= last; y++)
+      {
+        int *p = bmp->row[y] + bmp->cl;
+
+        for (int x = 0; x < bmp->cw; x++)
+        {
+          *p = lookup(*p);
+          p++;
+        }
+      }
+    });
+
+    if (show_progress)
+    {
+      for (int y = y1; y <= y2; y++)
+      {
+        if (Gui::progressUpdate(y) < 0)
+          return -1;
+      }
+    }
+  }
+
+  if (show_progress)
+    Gui::progressHide();
+
+  return 0;
+}
@@ -0,0 +1,236 @@
+/*
+Copyright (c) 2024 Joe Davisson.
+
+This file is part of Rendera.
+
+Rendera is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+Rendera is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Rendera; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+*/
+
+#include <algorithm>
+#include <vector>
+
+#include "Bitmap.H"
+#include "Convolution.H"
+#include "Inline.H"
+
+// The kernel is given in row order (matrix[y][x]). Rank-one kernels,
+// such as the blurs and Sobel operators, are split into a horizontal and
+// a vertical pass.
+Convolution::Convolution(Bitmap *src, const int *matrix, const int kernel_size)
+{
+  bmp = src;
+  size = kernel_size;
+  radius = size / 2;
+  pivot = 1;
+  last_y = bmp->ct - size - 1;
+  separable = false;
+
+  // find the first non-zero element and test if every row is a multiple
+  // of the row it is in
+  int pr = -1;
+  int pc = -1;
+
+  for (int i = 0; i < size * size; i++)
+  {
+    if (matrix[i] != 0)
+    {
+      pr = i / size;
+      pc = i % size;
+      break;
+    }
+  }
+
+  if (pr >= 0)
+  {
+    separable = true;
+    pivot = matrix[pr * size + pc];
+
+    for (int j = 0; j < size; j++)
+    {
+      for (int i = 0; i < size; i++)
+      {
+        if (matrix[j * size + i] * pivot
+              != matrix[j * size + pc] * matrix[pr * size + i])
+        {
+          separable = false;
+        }
+      }
+    }
+  }
+
+  if (separable)
+  {
+    // matrix[j][i] == kernel_y[j] * kernel_x[i] / pivot
+    kernel_x.resize(size);
+    kernel_y.resize(size);
+
+    bool divisible = true;
+
+    for (int i = 0; i < size; i++)
+    {
+      kernel_x[i] = matrix[pr * size + i];
+      kernel_y[i] = matrix[i * size + pc];
+
+      if (kernel_y[i] % pivot != 0)
+        divisible = false;
+    }
+
+    if (divisible)
+    {
+      for (int i = 0; i < size; i++)
+        kernel_y[i] /= pivot;
+
+      pivot = 1;
+    }
+
+    for (int j = 0; j < size; j++)
+    {
+      if (kernel_y[j] != 0)
+        taps.push_back({ 0, j, kernel_y[j] });
+    }
+  }
+  else
+  {
+    pivot = 1;
+
+    for (int j = 0; j < size; j++)
+    {
+      for (int i = 0; i < size; i++)
+      {
+        if (matrix[j * size + i] != 0)
+          taps.push_back({ i * 4, j, matrix[j * size + i] });
+      }
+    }
+  }
+
+  padded.resize((bmp->cw + radius * 2) * 4);
+  ring.resize(padded.size() * size);
+  sums.resize(bmp->cw * 4);
+}
+
+Convolution::~Convolution()
+{
+}
+
+// ring buffer entry for a source row
+int *Convolution::slot(const int y)
+{
+  int index = y % size;
+
+  if (index < 0)
+    index += size;
+
+  return &ring[index * padded.size()];
+}
+
+// unpacks a source row with its edges repeated, then applies the
+// horizontal pass if the kernel is separable
+void Convolution::load(const int y)
+{
+  const int *s = bmp->row[std::min(std::max(y, bmp->ct), bmp->cb)] + bmp->cl;
+  int *dest = separable ? &padded[0] : slot(y);
+  int *d = dest;
+
+  for (int i = 0; i < radius; i++)
+  {
+    const rgba_type rgba = getRgba(s[0]);
+
+    *d++ = rgba.r;
+    *d++ = rgba.g;
+    *d++ = rgba.b;
+    *d++ = rgba.a;
+  }
+
+  for (int x = 0; x < bmp->cw; x++)
+  {
+    const rgba_type rgba = getRgba(s[x]);
+
+    *d++ = rgba.r;
+    *d++ = rgba.g;
+    *d++ = rgba.b;
+    *d++ = rgba.a;
+  }
+
+  for (int i = 0; i < radius; i++)
+  {
+    const rgba_type rgba = getRgba(s[bmp->cw - 1]);
+
+    *d++ = rgba.r;
+    *d++ = rgba.g;
+    *d++ = rgba.b;
+    *d++ = rgba.a;
+  }
+
+  if (separable)
+  {
+    int *h = slot(y);
+    const int count = bmp->cw * 4;
+
+    for (int k = 0; k < count; k++)
+      h[k] = 0;
+
+    for (int i = 0; i < size; i++)
+    {
+      const int weight = kernel_x[i];
+      const int *p = dest + i * 4;
+
+      if (weight == 0)
+        continue;
+
+      for (int k = 0; k < count; k++)
+        h[k] += weight * p[k];
+    }
+  }
+}
+
+// returns the sums for row y of the clipping area, cw pixels long,
+// starting at the left clip edge
+const int *Convolution::row(const int y)
+{
+  if (y == last_y + 1)
+  {
+    load(y + radius);
+  }
+  else
+  {
+    for (int j = y - radius; j <= y + radius; j++)
+      load(j);
+  }
+
+  last_y = y;
+
+  const int count = bmp->cw * 4;
+  int *d = &sums[0];
+
+  for (int k = 0; k < count; k++)
+    d[k] = 0;
+
+  for (size_t t = 0; t < taps.size(); t++)
+  {
+    const int weight = taps[t].weight;
+    const int *p = slot(y - radius + taps[t].row) + taps[t].offset;
+
+    for (int k = 0; k < count; k++)
+      d[k] += weight * p[k];
+  }
+
+  if (pivot != 1)
+  {
+    for (int k = 0; k < count; k++)
+      d[k] /= pivot;
+  }
+
+  return d;
+}
@@ -441,6 +441,8 @@ namespace MakePalette
   {
     DialogWindow *dialog;
     InputInt *colors;
+    Fl_Choice *method;
+    CheckBox *refine;
     Fl_Button *ok;
     Fl_Button *cancel;
   }
@@ -456,7 +458,9 @@ namespace MakePalette
   void close()
   {
     Items::dialog->hide();
-    Quantize::pca(Project::bmp, Project::palette, atoi(Items::colors->value()));
+    Quantize::apply(Project::bmp, Project::palette,
+                    atoi(Items::colors->value()),
+                    Items::method->value(), Items::refine->value());
     Gui::paletteDraw();
     Project::palette->fillTable();
   }
@@ -470,10 +474,25 @@ namespace MakePalette
   {
     int y1 = 8;
 
+    int ww = 0;
+    int hh = 0;
+
     Items::dialog = new DialogWindow(256, 0, "Create Palette");
     Items::colors = new InputInt(Items::dialog, 0, 8, 96, 24, "Colors:", 0, 1, 256);
     Items::colors->center();
     y1 += 24 + 8;
+    Items::method = new Fl_Choice(0, y1, 128, 24, "Method:");
+    Items::method->tooltip("Quantization Method");
+    Items::method->textsize(10);
+    Items::method->add("Pairwise Clustering");
+    Items::method->add("Median Cut (Fast)");
+    Items::method->value(0);
+    Items::method->measure_label(ww, hh);
+    Items::method->resize(Items::dialog->x() + Items::dialog->w() / 2 - (Items::method->w() + ww) / 2 + ww, Items::method->y(), Items::method->w(), Items::method->h());
+    y1 += 24 + 8;
+    Items::refine = new CheckBox(Items::dialog, 0, y1, 16, 16, "Refine (K-Means)", 0);
+    Items::refine->center();
+    y1 += 16 + 8;
     Items::dialog->addOkCancelButtons(&Items::ok, &Items::cancel, &y1);
     Items::ok->callback((Fl_Callback *)close);
     Items::cancel->callback((Fl_Callback *)quit);
@@ -18,6 +18,8 @@ along with Rendera; if not, write to the Free Software
 Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
 */
 
+#include <algorithm>
+
 #include "Bloom.H"
 
 namespace
@@ -25,6 +27,7 @@ namespace
   namespace Items
   {
     DialogWindow *dialog;
+    Widget *preview;
     InputInt *radius;
     InputInt *blend;
     InputInt *threshold;
@@ -33,111 +36,23 @@ namespace
   }
 }
 
+// Pixels above the threshold are converted to linear light, blurred with
+// three running-sum box passes in each direction and added back to the
+// image. It's streamed row by row, with the threshold taken as rows come
+// in and the glow added as they leave the last vertical pass, so the
+// image only goes through memory once (see Chain.cxx). The cost doesn't
+// depend on the radius.
 void Bloom::apply(Bitmap *bmp, int radius, int threshold, int blend)
 {
-  radius = (radius + 1) * 2;
-
-  std::vector<int> kernel(radius);
-  int div = 0;
-
-  // bell curve
-  const int b = radius / 2;
-
-  for (int x = 0; x < radius; x++)
-  {
-    kernel[x] = 255 * std::exp(-((double)((x - b) * (x - b)) /
-                                         ((b * b) / 2)));
-    div += kernel[x];
-  }
+  Chain chain;
 
-  Bitmap temp(bmp->cw, bmp->ch);
-  Gui::progressShow(bmp->h);
-
-  // x direction
-  for (int y = bmp->ct; y <= bmp->cb; y++)
-  {
-    int *p = temp.row[y - bmp->ct];
-
-    for (int x = bmp->cl; x <= bmp->cr; x++)
-    {
-      int rr = 0;
-      int gg = 0;
-      int bb = 0;
-      int aa = 0;
-
-      for (int i = 0; i < radius; i++) 
-      {
-        const int mul = kernel[i];
-        rgba_type rgba = getRgba(bmp->getpixel(x - radius / 2 + i, y));
-
-        if (getlUnpacked(rgba.r, rgba.g, rgba.b) > threshold)
-        {
-          rr += Gamma::fix(rgba.r) * mul;
-          gg += Gamma::fix(rgba.g) * mul;
-          bb += Gamma::fix(rgba.b) * mul;
-          aa += rgba.a * mul;
-        }
-      }
-
-      rr = Gamma::unfix(rr / div);
-      gg = Gamma::unfix(gg / div);
-      bb = Gamma::unfix(bb / div);
-      aa /= div;
-
-      *p = makeRgba(rr, gg, bb, aa);
-      p++;
-    }
-
-    if (Gui::progressUpdate(y) < 0)
-      return;
-  }
-
-  Gui::progressShow(bmp->h);
-
-  // y direction
-  for (int y = bmp->ct; y <= bmp->cb; y++)
-  {
-    int *p = bmp->row[y] + bmp->cl;
-
-    for (int x = bmp->cl; x <= bmp->cr; x++)
-    {
-      int rr = 0;
-      int gg = 0;
-      int bb = 0;
-      int aa = 0;
-
-      for (int i = 0; i < radius; i++) 
-      {
-        const int mul = kernel[i];
-        rgba_type rgba = getRgba(temp.getpixel(x - bmp->cl,
-                                               y - radius / 2 + i - bmp->ct));
-
-        rr += Gamma::fix(rgba.r) * mul;
-        gg += Gamma::fix(rgba.g) * mul;
-        bb += Gamma::fix(rgba.b) * mul;
-        aa += rgba.a * mul;
-      }
-
-      rr = Gamma::unfix(rr / div);
-      gg = Gamma::unfix(gg / div);
-      bb = Gamma::unfix(bb / div);
-      aa /= div;
-
-      int c3 = makeRgba(rr, gg, bb, aa);
-
-      *p = Blend::lighten(*p, c3, blend);
-      p++;
-    }
-
-    if (Gui::progressUpdate(y) < 0)
-      return;
-  }
-
-  Gui::progressHide();
+  chain.addBloom(radius, threshold, blend);
+  chain.apply(bmp);
 }
 
 void Bloom::close()
 {
+  Preview::end();
   Items::dialog->hide();
   Project::undo->push();
 
@@ -150,12 +65,15 @@ void Bloom::close()
 
 void Bloom::quit()
 {
+  Preview::end();
   Gui::progressHide();
   Items::dialog->hide();
 }
 
 void Bloom::begin()
 {
+  Preview::begin(Items::preview);
+  preview();
   Items::dialog->show();
 }
 
@@ -164,15 +82,17 @@ void Bloom::init()
   int y1 = 8;
 
   Items::dialog = new DialogWindow(256, 0, "Bloom");
-  Items::radius = new InputInt(Items::dialog, 0, y1, 96, 24, "Radius (0-100)", 0, 1, 100);
+  Items::preview = new Widget(Items::dialog, 8, y1, 240, 240, 0, 1, 1, 0);
+  y1 += 240 + 8;
+  Items::radius = new InputInt(Items::dialog, 0, y1, 96, 24, "Radius (0-100)", (Fl_Callback *)preview, 1, 100);
   Items::radius->value("16");
   Items::radius->center();
   y1 += 24 + 8;
-  Items::threshold = new InputInt(Items::dialog, 0, y1, 96, 24, "Threshold (0-255)", 0, 0, 255);
+  Items::threshold = new InputInt(Items::dialog, 0, y1, 96, 24, "Threshold (0-255)", (Fl_Callback *)preview, 0, 255);
   Items::threshold->value("128");
   Items::threshold->center();
   y1 += 24 + 8;
-  Items::blend = new InputInt(Items::dialog, 0, y1, 96, 24, "Blend %", 0, 0, 100);
+  Items::blend = new InputInt(Items::dialog, 0, y1, 96, 24, "Blend %", (Fl_Callback *)preview, 0, 100);
   Items::blend->value("25");
   Items::blend->center();
   y1 += 24 + 8;
@@ -183,3 +103,15 @@ void Bloom::init()
   Items::dialog->end();
 }
 
+void Bloom::preview()
+{
+  const int radius = atoi(Items::radius->value());
+  const int threshold = atoi(Items::threshold->value());
+  const int blend = 255 - atoi(Items::blend->value()) * 2.55;
+
+  Preview::update([=](Bitmap *bmp, float scale)
+  {
+    apply(bmp, std::max(1, (int)(radius * scale + .5f)), threshold, blend);
+  });
+}
+
@@ -27,7 +27,8 @@ enum
   SHARPEN,
   EDGE_DETECT,
   EMBOSS,
-  EMBOSS_REVERSE
+  EMBOSS_REVERSE,
+  GAUSSIAN_BLUR_5X5
 };
 
 namespace
@@ -35,108 +36,101 @@ namespace
   namespace Items
   {
     DialogWindow *dialog;
+    Widget *preview;
     Fl_Choice *mode;
     InputInt *amount;
     Fl_Button *ok;
     Fl_Button *cancel;
   }
-
-  void copyMatrix(const int src[3][3], int dest[3][3])
-  {
-    for (int j = 0; j < 3; j++) 
-    {
-      for (int i = 0; i < 3; i++) 
-      {
-        dest[i][j] = src[i][j];
-      }
-    }
-  }
 }
 
 void BoxFilters::apply(Bitmap *bmp, int amount, int mode)
 {
+  const int *matrix = &FilterMatrix::blur[0][0];
+  int size = 3;
   int div = 1;
-  int matrix[3][3];
 
   switch (mode)
   {
     case BOX_BLUR:
-      copyMatrix(FilterMatrix::blur, matrix);
+      matrix = &FilterMatrix::blur[0][0];
       div = 9;
       break;
     case GAUSSIAN_BLUR:
-      copyMatrix(FilterMatrix::gaussian, matrix);
+      matrix = &FilterMatrix::gaussian[0][0];
       div = 16;
       break;
     case SHARPEN:
-      copyMatrix(FilterMatrix::sharpen, matrix);
+      matrix = &FilterMatrix::sharpen[0][0];
       div = 1;
       break;
     case EDGE_DETECT:
-      copyMatrix(FilterMatrix::edge, matrix);
+      matrix = &FilterMatrix::edge[0][0];
       div = 1;
       break;
     case EMBOSS:
-      copyMatrix(FilterMatrix::emboss, matrix);
+      matrix = &FilterMatrix::emboss[0][0];
       div = 1;
       break;
     case EMBOSS_REVERSE:
-      copyMatrix(FilterMatrix::emboss_reverse, matrix);
+      matrix = &FilterMatrix::emboss_reverse[0][0];
       div = 1;
       break;
+    case GAUSSIAN_BLUR_5X5:
+      matrix = &FilterMatrix::gaussian5[0][0];
+      size = 5;
+      div = 256;
+      break;
   }
 
-  Bitmap temp(bmp->cw, bmp->ch);
+  // the convolution reads from a copy so rows can be written in place
+  Bitmap src(bmp->cw, bmp->ch);
+  bmp->blit(&src, bmp->cl, bmp->ct, 0, 0, bmp->cw, bmp->ch);
+
+  const int trans = 255 - amount * 2.55;
+  const int batch = 256;
+
   Gui::progressShow(bmp->h);
 
-  for (int y = bmp->ct; y <= bmp->cb; y++)
+  for (int y1 = bmp->ct; y1 <= bmp->cb; y1 += batch)
   {
-    int *p = temp.row[y - bmp->cl];
+    const int y2 = std::min(y1 + batch - 1, bmp->cb);
 
-    for (int x = bmp->cl; x <= bmp->cr; x++)
+    Threads::run(y1, y2, [&](int, int first, int last)
     {
-      int r = 0;
-      int g = 0;
-      int b = 0;
+      Convolution conv(&src, matrix, size);
 
-      for (int j = 0; j < 3; j++) 
+      for (int y = first; y <= last; y++)
       {
-        for (int i = 0; i < 3; i++) 
+        const int *s = conv.row(y - bmp->ct);
+        int *p = bmp->row[y] + bmp->cl;
+
+        for (int x = 0; x < bmp->cw; x++)
         {
-          const rgba_type rgba = getRgba(bmp->getpixel(x + i - 1, y + j - 1));
+          const int r = clamp(s[0] / div, 255);
+          const int g = clamp(s[1] / div, 255);
+          const int b = clamp(s[2] / div, 255);
+          const int c = *p;
 
-          r += rgba.r * matrix[i][j];
-          g += rgba.g * matrix[i][j];
-          b += rgba.b * matrix[i][j];
+          *p++ = Blend::trans(c, makeRgba(r, g, b, geta(c)), trans);
+          s += 4;
         }
       }
+    });
 
-      r /= div;
-      g /= div;
-      b /= div;
-
-      r = clamp(r, 255);
-      g = clamp(g, 255);
-      b = clamp(b, 255);
-
-      const int c = bmp->getpixel(x, y);
-
-      *p = Blend::trans(c, makeRgba(r, g, b, geta(c)), 255 - amount * 2.55);
-      p++;
+    for (int y = y1; y <= y2; y++)
+    {
+      if (Gui::progressUpdate(y) < 0)
+        return;
     }
-
-    if (Gui::progressUpdate(y) < 0)
-      return;
   }
 
-  temp.blit(bmp, 0, 0, bmp->cl, bmp->ct, temp.w, temp.h);
-
   Gui::progressHide();
-
 }
 
 void BoxFilters::close()
 {
+  Preview::end();
   Items::dialog->hide();
   Project::undo->push();
 
@@ -148,12 +142,15 @@ void BoxFilters::close()
 
 void BoxFilters::quit()
 {
+  Preview::end();
   Gui::progressHide();
   Items::dialog->hide();
 }
 
 void BoxFilters::begin()
 {
+  Preview::begin(Items::preview);
+  preview();
   Items::dialog->show();
 }
 
@@ -164,6 +161,8 @@ void BoxFilters::init()
   int hh = 0;
 
   Items::dialog = new DialogWindow(256, 0, "Box Filters");
+  Items::preview = new Widget(Items::dialog, 8, y1, 240, 240, 0, 1, 1, 0);
+  y1 += 240 + 8;
   Items::mode = new Fl_Choice(0, y1, 128, 24, "Filter:");
   Items::mode->textsize(10);
   Items::mode->add("Box Blur");
@@ -172,11 +171,13 @@ void BoxFilters::init()
   Items::mode->add("Edge Detect");
   Items::mode->add("Emboss");
   Items::mode->add("Emboss (Inverse)");
+  Items::mode->add("Gaussian Blur (5x5)");
   Items::mode->value(0);
+  Items::mode->callback((Fl_Callback *)preview);
   Items::mode->measure_label(ww, hh);
   Items::mode->resize(Items::dialog->x() + Items::dialog->w() / 2 - (Items::mode->w() + ww) / 2 + ww, Items::mode->y(), Items::mode->w(), Items::mode->h());
   y1 += 24 + 8;
-  Items::amount = new InputInt(Items::dialog, 0, y1, 96, 24, "Amount %", 0, 0, 100);
+  Items::amount = new InputInt(Items::dialog, 0, y1, 96, 24, "Amount %", (Fl_Callback *)preview, 0, 100);
   Items::amount->value("50");
   Items::amount->center();
   y1 += 24 + 8;
@@ -186,3 +187,14 @@ void BoxFilters::init()
   Items::dialog->set_modal();
   Items::dialog->end();
 }
+
+void BoxFilters::preview()
+{
+  const int amount = atoi(Items::amount->value());
+  const int mode = Items::mode->value();
+
+  Preview::update([=](Bitmap *bmp, float)
+  {
+    apply(bmp, amount, mode);
+  });
+}
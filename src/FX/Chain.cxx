@@ -0,0 +1,715 @@
+/*
+Copyright (c) 2024 Joe Davisson.
+
+This file is part of Rendera.
+
+Rendera is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+Rendera is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Rendera; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+*/
+
+#include <algorithm>
+#include <cmath>
+#include <stdint.h>
+#include <vector>
+
+#include "Chain.H"
+
+namespace
+{
+  enum
+  {
+    NORMALIZE,
+    SATURATE,
+    UNSHARP_MASK,
+    BLOOM,
+    DITHER,
+    // only used for steps, color changes merged into one table
+    TABLE
+  };
+
+  // Rows of the selection produced one at a time, in order, by one stage
+  // of a streamed pass. Asking for the same row twice does no extra work.
+  // The row returned stays valid until the next call.
+  class Rows
+  {
+  public:
+    virtual ~Rows() { }
+    virtual const int *row(const int) = 0;
+  };
+
+  // red, green and blue planes of a row in 16-bit linear light, with the
+  // same rules as above
+  class LinearRows
+  {
+  public:
+    virtual ~LinearRows() { }
+    virtual const uint16_t *row(const int) = 0;
+  };
+
+  // rows of the copy the pass reads from
+  class SourceRows : public Rows
+  {
+  public:
+    SourceRows(Bitmap *src)
+    {
+      this->src = src;
+    }
+
+    const int *row(const int y)
+    {
+      return src->row[y];
+    }
+
+  private:
+    Bitmap *src;
+  };
+
+  // colors passed through a table
+  class LutRows : public Rows
+  {
+  public:
+    LutRows(Rows *input, const ColorLut *lut, const int w)
+    {
+      this->input = input;
+      this->lut = lut;
+      buffer.resize(w);
+      last_y = -1;
+    }
+
+    const int *row(const int y)
+    {
+      if (y != last_y)
+      {
+        const int *p = input->row(y);
+
+        for (size_t x = 0; x < buffer.size(); x++)
+          buffer[x] = lut->lookup(p[x]);
+
+        last_y = y;
+      }
+
+      return &buffer[0];
+    }
+
+  private:
+    Rows *input;
+    const ColorLut *lut;
+    std::vector<int> buffer;
+    int last_y;
+  };
+
+  // box size giving the same spread as the unsharp mask's bell curve,
+  // which has a standard deviation of (radius + 1) / 2
+  int boxSize(const int radius)
+  {
+    const float sigma = (radius + 1) / 2.0f;
+    int size = std::sqrt(4 * sigma * sigma + 1) + 0.5f;
+
+    // force odd value to prevent image shift
+    if ((size & 1) == 0)
+      size += 1;
+
+    return size;
+  }
+
+  // rows above and below needed by three box passes
+  int boxReach(const int radius)
+  {
+    return (boxSize(radius) / 2) * 3;
+  }
+
+  // Converts rows to linear light and blurs them with three horizontal
+  // box passes. Pixels no brighter than the threshold are taken as black.
+  // The original rows are kept for a while, since they are needed again
+  // once the vertical passes catch up.
+  class BlurRowsX : public LinearRows
+  {
+  public:
+    BlurRowsX(Rows *input, const int w, const int size, const int keep,
+              const int threshold)
+    {
+      this->input = input;
+      this->w = w;
+      this->size = size;
+      this->keep = keep;
+      this->threshold = threshold;
+      planes.resize(w * 3);
+      temp.resize(w);
+      kept.resize(w * keep);
+      last_y = -1;
+    }
+
+    const uint16_t *row(const int y)
+    {
+      if (y == last_y)
+        return &planes[0];
+
+      const int *p = input->row(y);
+
+      std::copy(p, p + w, &kept[(y % keep) * w]);
+
+      for (int x = 0; x < w; x++)
+      {
+        const rgba_type rgba = getRgba(p[x]);
+
+        if (getlUnpacked(rgba.r, rgba.g, rgba.b) > threshold)
+        {
+          planes[x] = Gamma::fix(rgba.r);
+          planes[w + x] = Gamma::fix(rgba.g);
+          planes[w * 2 + x] = Gamma::fix(rgba.b);
+        }
+          else
+        {
+          planes[x] = 0;
+          planes[w + x] = 0;
+          planes[w * 2 + x] = 0;
+        }
+      }
+
+      for (int pass = 0; pass < 3; pass++)
+      {
+        for (int c = 0; c < 3; c++)
+          blur(&planes[w * c]);
+      }
+
+      last_y = y;
+
+      return &planes[0];
+    }
+
+    const int *original(const int y)
+    {
+      return &kept[(y % keep) * w];
+    }
+
+  private:
+    // running sum with the border pixels repeated
+    void blur(uint16_t *dest)
+    {
+      const int lo = size / 2;
+      const int hi = size - lo - 1;
+      const int last = w - 1;
+      const int half = size / 2;
+      const uint16_t *src = &temp[0];
+
+      std::copy(dest, dest + w, temp.begin());
+
+      auto at = [&](const int i)
+      {
+        return src[i < 0 ? 0 : (i > last ? last : i)];
+      };
+
+      int sum = 0;
+
+      for (int i = -lo; i <= hi; i++)
+        sum += at(i);
+
+      for (int x = 0; x < w; x++)
+      {
+        dest[x] = (sum + half) / size;
+        sum += at(x + hi + 1) - at(x - lo);
+      }
+    }
+
+    Rows *input;
+    int w;
+    int size;
+    int keep;
+    int threshold;
+    std::vector<uint16_t> planes;
+    std::vector<uint16_t> temp;
+    std::vector<int> kept;
+    int last_y;
+  };
+
+  // Box pass down the columns, keeping a running sum per column. Rows
+  // inside the window are kept in a ring so the one leaving can be taken
+  // off the sum. Rows past the top and bottom repeat the border row.
+  class BlurRowsY : public LinearRows
+  {
+  public:
+    BlurRowsY(LinearRows *input, const int w, const int h, const int size)
+    {
+      this->input = input;
+      this->h = h;
+      this->size = size;
+      count = w * 3;
+      slots = size + 1;
+      ring.resize(count * slots);
+      sum.resize(count);
+      buffer.resize(count);
+      last_y = -h - size - 1;
+    }
+
+    const uint16_t *row(const int y)
+    {
+      if (y == last_y)
+        return &buffer[0];
+
+      const int lo = size / 2;
+      const int hi = size - lo - 1;
+
+      if (y == last_y + 1)
+      {
+        const uint16_t *sub = slot(y - lo - 1);
+        const uint16_t *add = fetch(y + hi);
+
+        for (int k = 0; k < count; k++)
+          sum[k] += add[k] - sub[k];
+      }
+        else
+      {
+        std::fill(sum.begin(), sum.end(), 0);
+
+        for (int i = y - lo; i <= y + hi; i++)
+        {
+          const uint16_t *add = fetch(i);
+
+          for (int k = 0; k < count; k++)
+            sum[k] += add[k];
+        }
+      }
+
+      const int half = size / 2;
+
+      for (int k = 0; k < count; k++)
+        buffer[k] = (sum[k] + half) / size;
+
+      last_y = y;
+
+      return &buffer[0];
+    }
+
+  private:
+    uint16_t *slot(const int i)
+    {
+      return &ring[(((i % slots) + slots) % slots) * count];
+    }
+
+    const uint16_t *fetch(const int i)
+    {
+      const uint16_t *src = input->row(std::min(std::max(i, 0), h - 1));
+      uint16_t *dest = slot(i);
+
+      std::copy(src, src + count, dest);
+
+      return dest;
+    }
+
+    LinearRows *input;
+    int h;
+    int size;
+    int count;
+    int slots;
+    std::vector<uint16_t> ring;
+    std::vector<int> sum;
+    std::vector<uint16_t> buffer;
+    int last_y;
+  };
+
+  // Unsharp mask blended as each blurred row comes out of the last
+  // vertical pass. The blur is three box passes each way in linear light,
+  // so its cost doesn't depend on the radius.
+  class UnsharpRows : public Rows
+  {
+  public:
+    UnsharpRows(Rows *input, const int w, const int h,
+                const int radius, const double amount, const int threshold)
+    {
+      const int size = boxSize(radius);
+
+      this->w = w;
+      this->amount = amount;
+      this->threshold = threshold;
+      blur_x = new BlurRowsX(input, w, size, boxReach(radius) + 2, -1);
+      blur_y1 = new BlurRowsY(blur_x, w, h, size);
+      blur_y2 = new BlurRowsY(blur_y1, w, h, size);
+      blur_y3 = new BlurRowsY(blur_y2, w, h, size);
+      buffer.resize(w);
+      last_y = -1;
+    }
+
+    ~UnsharpRows()
+    {
+      delete blur_y3;
+      delete blur_y2;
+      delete blur_y1;
+      delete blur_x;
+    }
+
+    const int *row(const int y)
+    {
+      if (y == last_y)
+        return &buffer[0];
+
+      const uint16_t *blur = blur_y3->row(y);
+      const int *p = blur_x->original(y);
+
+      for (int x = 0; x < w; x++)
+      {
+        const int c = p[x];
+        const int blurred = makeRgba(Gamma::unfix(blur[x]),
+                                     Gamma::unfix(blur[w + x]),
+                                     Gamma::unfix(blur[w * 2 + x]),
+                                     geta(c));
+        const int a = getl(blurred);
+        const int b = getl(c);
+
+        if (std::abs(a - b) >= threshold)
+        {
+          int lum = a - (amount * (a - b));
+
+          lum = clamp(lum, 255);
+          buffer[x] = Blend::keepLum(blurred, lum);
+        }
+          else
+        {
+          buffer[x] = c;
+        }
+      }
+
+      last_y = y;
+
+      return &buffer[0];
+    }
+
+  private:
+    int w;
+    double amount;
+    int threshold;
+    BlurRowsX *blur_x;
+    BlurRowsY *blur_y1;
+    BlurRowsY *blur_y2;
+    BlurRowsY *blur_y3;
+    std::vector<int> buffer;
+    int last_y;
+  };
+
+  // Bloom added as each blurred row comes out of the last vertical pass.
+  // Only pixels above the threshold are blurred, with the same three box
+  // passes each way as the unsharp mask.
+  class BloomRows : public Rows
+  {
+  public:
+    BloomRows(Rows *input, const int w, const int h,
+              const int radius, const int threshold, const int blend)
+    {
+      const int size = boxSize(radius);
+
+      this->w = w;
+      this->blend = blend;
+      blur_x = new BlurRowsX(input, w, size, boxReach(radius) + 2, threshold);
+      blur_y1 = new BlurRowsY(blur_x, w, h, size);
+      blur_y2 = new BlurRowsY(blur_y1, w, h, size);
+      blur_y3 = new BlurRowsY(blur_y2, w, h, size);
+      buffer.resize(w);
+      last_y = -1;
+    }
+
+    ~BloomRows()
+    {
+      delete blur_y3;
+      delete blur_y2;
+      delete blur_y1;
+      delete blur_x;
+    }
+
+    const int *row(const int y)
+    {
+      if (y == last_y)
+        return &buffer[0];
+
+      const uint16_t *blur = blur_y3->row(y);
+      const int *p = blur_x->original(y);
+
+      for (int x = 0; x < w; x++)
+      {
+        const int glow = makeRgba(Gamma::unfix(blur[x]),
+                                  Gamma::unfix(blur[w + x]),
+                                  Gamma::unfix(blur[w * 2 + x]), 0);
+
+        buffer[x] = Blend::lighten(p[x], glow, blend);
+      }
+
+      last_y = y;
+
+      return &buffer[0];
+    }
+
+  private:
+    int w;
+    int blend;
+    BlurRowsX *blur_x;
+    BlurRowsY *blur_y1;
+    BlurRowsY *blur_y2;
+    BlurRowsY *blur_y3;
+    std::vector<int> buffer;
+    int last_y;
+  };
+
+  // one stage of a streamed pass, a color table, unsharp mask or bloom
+  struct step_type
+  {
+    int type;
+    ColorLut lut;
+    int radius;
+    double amount;
+    int threshold;
+    int blend;
+  };
+
+  // Runs the steps over the selection, returns -1 if cancelled. Each
+  // thread streams a band of rows through every step, reading from a
+  // copy of the selection and writing the results in place.
+  int runSteps(Bitmap *bmp, std::vector<step_type> &steps)
+  {
+    if (steps.size() == 0)
+      return 0;
+
+    // a single table doesn't need a copy
+    if (steps.size() == 1 && steps[0].type == TABLE)
+      return steps[0].lut.apply(bmp, true);
+
+    Bitmap src(bmp->cw, bmp->ch);
+    bmp->blit(&src, bmp->cl, bmp->ct, 0, 0, bmp->cw, bmp->ch);
+
+    // bands must be tall enough that starting one up is cheap
+    int reach = 0;
+
+    for (size_t i = 0; i < steps.size(); i++)
+    {
+      if (steps[i].type != TABLE)
+        reach += boxReach(steps[i].radius);
+    }
+
+    const int batch = std::max(64, reach * 8) * Threads::count();
+
+    Gui::progressShow(bmp->h);
+
+    for (int y1 = bmp->ct; y1 <= bmp->cb; y1 += batch)
+    {
+      const int y2 = std::min(y1 + batch - 1, bmp->cb);
+
+      Threads::run(y1, y2, [&](int, int first, int last)
+      {
+        std::vector<Rows *> rows;
+
+        rows.push_back(new SourceRows(&src));
+
+        for (size_t i = 0; i < steps.size(); i++)
+        {
+          if (steps[i].type == UNSHARP_MASK)
+          {
+            rows.push_back(new UnsharpRows(rows.back(), bmp->cw, bmp->ch,
+                                           steps[i].radius, steps[i].amount,
+                                           steps[i].threshold));
+          }
+            else if (steps[i].type == BLOOM)
+          {
+            rows.push_back(new BloomRows(rows.back(), bmp->cw, bmp->ch,
+                                         steps[i].radius, steps[i].threshold,
+                                         steps[i].blend));
+          }
+            else
+          {
+            rows.push_back(new LutRows(rows.back(), &steps[i].lut, bmp->cw));
+          }
+        }
+
+        for (int y = first; y <= last; y++)
+        {
+          const int *p = rows.back()->row(y - bmp->ct);
+
+          std::copy(p, p + bmp->cw, bmp->row[y] + bmp->cl);
+        }
+
+        for (size_t i = 0; i < rows.size(); i++)
+          delete rows[i];
+      });
+
+      for (int y = y1; y <= y2; y++)
+      {
+        if (Gui::progressUpdate(y) < 0)
+          return -1;
+      }
+    }
+
+    Gui::progressHide();
+
+    return 0;
+  }
+}
+
+Chain::Chain()
+{
+}
+
+Chain::~Chain()
+{
+}
+
+void Chain::addNormalize()
+{
+  stage_type stage = stage_type();
+
+  stage.type = NORMALIZE;
+  stages.push_back(stage);
+}
+
+void Chain::addSaturate()
+{
+  stage_type stage = stage_type();
+
+  stage.type = SATURATE;
+  stages.push_back(stage);
+}
+
+void Chain::addUnsharpMask(int radius, double amount, int threshold)
+{
+  stage_type stage = stage_type();
+
+  stage.type = UNSHARP_MASK;
+  stage.radius = radius;
+  stage.amount = amount;
+  stage.threshold = threshold;
+  stages.push_back(stage);
+}
+
+void Chain::addBloom(int radius, int threshold, int blend)
+{
+  stage_type stage = stage_type();
+
+  stage.type = BLOOM;
+  stage.radius = radius;
+  stage.threshold = threshold;
+  stage.blend = blend;
+  stages.push_back(stage);
+}
+
+void Chain::addDither(int mode, bool fix_gamma, bool lum_only,
+                      bool serpentine)
+{
+  stage_type stage = stage_type();
+
+  stage.type = DITHER;
+  stage.mode = mode;
+  stage.fix_gamma = fix_gamma;
+  stage.lum_only = lum_only;
+  stage.serpentine = serpentine;
+  stages.push_back(stage);
+}
+
+void Chain::apply(Bitmap *bmp)
+{
+  std::vector<step_type> steps;
+
+  // color changes since the last unsharp mask, merged into one table
+  ColorLut pending;
+  bool changed = false;
+  bool streamed = false;
+
+  for (size_t i = 0; i < stages.size(); i++)
+  {
+    const stage_type &stage = stages[i];
+
+    if (stage.type == NORMALIZE || stage.type == SATURATE)
+    {
+      // statistics are taken from this stage's input, which isn't known
+      // until any streamed stage before it has run
+      if (streamed)
+      {
+        if (runSteps(bmp, steps) < 0)
+          return;
+
+        steps.clear();
+        streamed = false;
+      }
+
+      ColorLut lut;
+      ColorLut combined;
+
+      if (stage.type == NORMALIZE)
+        Normalize::compile(&lut, bmp, pending);
+      else
+        Saturate::compile(&lut, bmp, pending);
+
+      combined.compose(pending, lut);
+      pending = combined;
+      changed = true;
+    }
+      else
+    {
+      if (changed)
+      {
+        step_type step = step_type();
+
+        step.type = TABLE;
+        step.lut = pending;
+        steps.push_back(step);
+        pending = ColorLut();
+        changed = false;
+      }
+
+      if (stage.type == UNSHARP_MASK || stage.type == BLOOM)
+      {
+        step_type step = step_type();
+
+        step.type = stage.type;
+        step.radius = stage.radius;
+        step.amount = stage.amount;
+        step.threshold = stage.threshold;
+        step.blend = stage.blend;
+        steps.push_back(step);
+        streamed = true;
+      }
+        else if (stage.type == DITHER)
+      {
+        if (runSteps(bmp, steps) < 0)
+          return;
+
+        steps.clear();
+        streamed = false;
+
+        Dither::apply(bmp, stage.mode, stage.fix_gamma,
+                      stage.lum_only, stage.serpentine);
+      }
+    }
+  }
+
+  if (changed)
+  {
+    step_type step = step_type();
+
+    step.type = TABLE;
+    step.lut = pending;
+    steps.push_back(step);
+  }
+
+  runSteps(bmp, steps);
+}
+
+// normalize, saturate, a light unsharp mask, then Floyd-Steinberg
+// dithering to the current palette
+void Chain::begin()
+{
+  Project::undo->push();
+
+  Chain chain;
+
+  chain.addNormalize();
+  chain.addSaturate();
+  chain.addUnsharpMask(1, 1.5, 0);
+  chain.addDither(1, true, false, false);
+  chain.apply(Project::bmp);
+}
@@ -24,43 +24,31 @@ void Colorize::apply(Bitmap *bmp, int color)
 {
   rgba_type rgba_color = getRgba(color);
 
-  Gui::progressShow(bmp->h);
+  ColorLut lut;
 
-  for (int y = bmp->ct; y <= bmp->cb; y++)
+  lut.compile([&](int r, int g, int b)
   {
-    int *p = bmp->row[y] + bmp->cl;
+    const int c = makeRgb(r, g, b);
+    int h, s, v;
 
-    for (int x = bmp->cl; x <= bmp->cr; x++)
-    {
-      rgba_type rgba = getRgba(*p);
+    Blend::rgbToHsv(r, g, b, &h, &s, &v);
 
-      int r = rgba.r;
-      int g = rgba.g;
-      int b = rgba.b;
-      int h, s, v;
+    int sat = s;
 
-      Blend::rgbToHsv(r, g, b, &h, &s, &v);
+    if (sat < 64)
+      sat = 64;
 
-      int sat = s;
+    r = rgba_color.r;
+    g = rgba_color.g;
+    b = rgba_color.b;
 
-      if (sat < 64)
-        sat = 64;
+    Blend::rgbToHsv(r, g, b, &h, &s, &v);
+    Blend::hsvToRgb(h, (sat * s) / (sat + s), v, &r, &g, &b);
 
-      r = rgba_color.r;
-      g = rgba_color.g;
-      b = rgba_color.b;
-      Blend::rgbToHsv(r, g, b, &h, &s, &v);
-      Blend::hsvToRgb(h, (sat * s) / (sat + s), v, &r, &g, &b);
+    return Blend::colorize(c, makeRgb(r, g, b), 0);
+  });
 
-      *p = Blend::colorize(*p, makeRgba(r, g, b, rgba.a), 0);
-      p++;
-    }
-
-    if (Gui::progressUpdate(y) < 0)
-      return;
-  }
-
-  Gui::progressHide();
+  lut.apply(bmp, true);
 }
 
 void Colorize::begin()
@@ -20,24 +20,39 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
 
 #include "Desaturate.H"
 
+// luminance is cheaper to compute than to look up, so this is a plain
+// parallel pass rather than a compiled table
 void Desaturate::apply(Bitmap *bmp)
 {
+  const int batch = 256;
+
   Gui::progressShow(bmp->h);
 
-  for (int y = bmp->ct; y <= bmp->cb; y++)
+  for (int y1 = bmp->ct; y1 <= bmp->cb; y1 += batch)
   {
-    int *p = bmp->row[y] + bmp->cl;
+    const int y2 = std::min(y1 + batch - 1, bmp->cb);
 
-    for (int x = bmp->cl; x <= bmp->cr; x++)
+    Threads::run(y1, y2, [&](int, int first, int last)
     {
-      const int l = getl(*p);
+      for (int y = first; y <= last; y++)
+      {
+        int *p = bmp->row[y] + bmp->cl;
 
-      *p = makeRgba(l, l, l, geta(*p));
-      p++;
-    }
+        for (int x = bmp->cl; x <= bmp->cr; x++)
+        {
+          const int l = getl(*p);
+
+          *p = makeRgba(l, l, l, geta(*p));
+          p++;
+        }
+      }
+    });
 
-    if (Gui::progressUpdate(y) < 0)
-      return;
+    for (int y = y1; y <= y2; y++)
+    {
+      if (Gui::progressUpdate(y) < 0)
+        return;
+    }
   }
 
   Gui::progressHide();
@@ -18,6 +18,12 @@ along with Rendera; if not, write to the Free Software
 Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
 */
 
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <thread>
+#include <vector>
+
 #include "Dither.H"
 
 namespace
@@ -25,9 +31,11 @@ namespace
   namespace Items
   {
     DialogWindow *dialog;
+    Widget *preview;
     Fl_Choice *mode;
     CheckBox *gamma;
     CheckBox *lum_only;
+    CheckBox *serpentine;
     Fl_Button *ok;
     Fl_Button *cancel;
   }
@@ -40,7 +48,9 @@ enum
   JARVIS,
   STUCKI,
   ATKINSON,
-  SIERRA
+  SIERRA,
+  BAYER,
+  BLUE_NOISE
 };
  
 namespace Threshold
@@ -115,12 +125,476 @@ namespace Sierra
   const int div = 32;
 }
 
-void Dither::apply(Bitmap *bmp, int mode, bool fix_gamma, bool lum_only)
+namespace
+{
+  // columns a row must stay behind the row above it, the kernels reach
+  // two rows down and two columns back, so with this lag no two rows
+  // touch the same pixel at once and every pixel receives its error in
+  // the same order as a serial scan
+  const int lag = 5;
+
+  // quantize one pixel and spread the error to its neighbors,
+  // dir is -1 when scanning right to left
+  void ditherPixel(Bitmap *bmp, const int x, const int y, const int dir,
+                   int (*matrix)[5], const int div,
+                   const bool fix_gamma, const bool lum_only)
+  {
+    const int w = 5, h = 3;
+    int *p = bmp->row[y] + x;
+
+    if (lum_only)
+    {
+      const int alpha = geta(*p);
+      const int old_l = getl(*p);
+      const int pal_index = Project::palette->lookup(Blend::keepLum(*p, old_l));
+      const int cp = Project::palette->data[pal_index];
+
+      rgba_type rgba = getRgba(cp);
+      *p = makeRgba(rgba.r, rgba.g, rgba.b, alpha);
+
+      const int new_l = getl(*p);
+      int el;
+
+      if (fix_gamma)
+      {
+        el = Gamma::fix(old_l) - Gamma::fix(new_l);
+
+        if (el < -16383) el = -16383;
+        if (el > 16383) el = 16383;
+      }
+        else
+      {
+        el = old_l - new_l;
+
+        if (el < -127) el = -127;
+        if (el > 127) el = 127;
+      }
+
+      for (int j = 0; j < h; j++)
+      {
+        for (int i = 0; i < w; i++)
+        {
+          if (matrix[j][i] > 0)
+          {
+            const int xx = x + (i - w / 2) * dir;
+
+            if (xx < bmp->cl || xx > bmp->cr || y + j > bmp->cb)
+              continue;
+
+            int c = bmp->getpixel(xx, y + j);
+            int l = getl(c);
+
+            if (fix_gamma)
+              l = Gamma::fix(l); 
+
+            l += (el * matrix[j][i]) / div;
+
+            if (fix_gamma)
+              l = Gamma::unfix(clamp(l, 65535));
+            else
+              l = clamp(l, 255);
+
+            rgba = getRgba(Blend::keepLum(c, l));
+
+            bmp->setpixel(xx, y + j,
+                          makeRgba(rgba.r, rgba.g, rgba.b, rgba.a));
+          }  
+        }
+      }
+    }
+      else
+    {
+      rgba_type rgba = getRgba(*p);
+      const int alpha = rgba.a;
+      const int old_r = rgba.r;
+      const int old_g = rgba.g;
+      const int old_b = rgba.b;
+
+      const int pal_index = Project::palette->lookup(*p);
+      const int c = Project::palette->data[pal_index];
+
+      rgba = getRgba(c);
+      *p = makeRgba(rgba.r, rgba.g, rgba.b, alpha);
+
+      const int new_r = rgba.r;
+      const int new_g = rgba.g;
+      const int new_b = rgba.b;
+      int er, eg, eb;
+
+      if (fix_gamma)
+      {
+        er = Gamma::fix(old_r) - Gamma::fix(new_r);
+        eg = Gamma::fix(old_g) - Gamma::fix(new_g);
+        eb = Gamma::fix(old_b) - Gamma::fix(new_b);
+
+        if (er < -16383) er = -16383;
+        if (er > 16383) er = 16383;
+        if (eg < -16383) eg = -16383;
+        if (eg > 16383) eg = 16383;
+        if (eb < -16383) eb = -16383;
+        if (eb > 16383) eb = 16383;
+      }
+        else
+      {
+        er = old_r - new_r;
+        eg = old_g - new_g;
+        eb = old_b - new_b;
+
+        if (er < -127) er = -127;
+        if (er > 127) er = 127;
+        if (eg < -127) eg = -127;
+        if (eg > 127) eg = 127;
+        if (eb < -127) eb = -127;
+        if (eb > 127) eb = 127;
+      }
+
+      for (int j = 0; j < h; j++)
+      {
+        for (int i = 0; i < w; i++)
+        {
+          if (matrix[j][i] > 0)
+          {
+            const int xx = x + (i - w / 2) * dir;
+
+            if (xx < bmp->cl || xx > bmp->cr || y + j > bmp->cb)
+              continue;
+
+            rgba = getRgba(bmp->getpixel(xx, y + j));
+            int r, g, b;
+
+            if (fix_gamma)
+            {
+              r = Gamma::fix(rgba.r); 
+              g = Gamma::fix(rgba.g); 
+              b = Gamma::fix(rgba.b);
+            }
+              else
+            {
+              r = rgba.r; 
+              g = rgba.g; 
+              b = rgba.b; 
+            }
+
+            r += (er * matrix[j][i]) / div;
+            g += (eg * matrix[j][i]) / div;
+            b += (eb * matrix[j][i]) / div;
+
+            if (fix_gamma)
+            {
+              r = Gamma::unfix(clamp(r, 65535));
+              g = Gamma::unfix(clamp(g, 65535));
+              b = Gamma::unfix(clamp(b, 65535));
+            }
+              else
+            {
+              r = clamp(r, 255);
+              g = clamp(g, 255);
+              b = clamp(b, 255);
+            }
+
+            bmp->setpixel(xx, y + j, makeRgba(r, g, b, rgba.a));
+          }  
+        }
+      }
+    }
+  }
+}
+
+namespace Bayer
+{
+  const int size = 8;
+  std::vector<float> matrix;
+
+  // recursive Bayer matrix, each bit level of the coordinates selects
+  // a quadrant of the 2x2 pattern { 0, 2 }, { 3, 1 }
+  void init()
+  {
+    const int pattern[2][2] = { { 0, 2 }, { 3, 1 } };
+
+    matrix.resize(size * size);
+
+    for (int y = 0; y < size; y++)
+    {
+      for (int x = 0; x < size; x++)
+      {
+        int v = 0;
+
+        for (int bit = 0; (1 << bit) < size; bit++)
+          v = v * 4 + pattern[(y >> bit) & 1][(x >> bit) & 1];
+
+        matrix[x + y * size] = (v + .5f) / (size * size) - .5f;
+      }
+    }
+  }
+}
+
+namespace BlueNoise
+{
+  const int size = 64;
+  std::vector<float> matrix;
+
+  // Builds a tileable blue noise threshold map using the void-and-cluster
+  // method. Energy is a wrapped gaussian of the placed points, points are
+  // moved from the tightest cluster to the largest void until the initial
+  // pattern is stable, then ranked by removing from and adding to it.
+  void init()
+  {
+    const int n = size * size;
+    const float sigma = 1.5f;
+
+    std::vector<float> kernel(n);
+
+    for (int y = 0; y < size; y++)
+    {
+      for (int x = 0; x < size; x++)
+      {
+        const int dx = std::min(x, size - x);
+        const int dy = std::min(y, size - y);
+
+        kernel[x + y * size] =
+          std::exp(-(dx * dx + dy * dy) / (2 * sigma * sigma));
+      }
+    }
+
+    auto update = [&](std::vector<float> &energy, const int pos,
+                      const float sign)
+    {
+      const int px = pos % size;
+      const int py = pos / size;
+
+      for (int y = 0; y < size; y++)
+      {
+        const float *k = &kernel[((y - py + size) % size) * size];
+
+        for (int x = 0; x < size; x++)
+          energy[x + y * size] += sign * k[(x - px + size) % size];
+      }
+    };
+
+    auto find = [&](const std::vector<float> &energy,
+                    const std::vector<char> &bits, const int value,
+                    const bool largest)
+    {
+      int best = -1;
+
+      for (int i = 0; i < n; i++)
+      {
+        if (bits[i] != value)
+          continue;
+
+        if (best < 0 || (largest ? energy[i] > energy[best]
+                                 : energy[i] < energy[best]))
+          best = i;
+      }
+
+      return best;
+    };
+
+    // initial random pattern
+    std::vector<char> bits(n, 0);
+    std::vector<float> energy(n, 0);
+    int ones = 0;
+
+    while (ones < n / 10)
+    {
+      const int pos = (rnd() & 0x7fffffff) % n;
+
+      if (!bits[pos])
+      {
+        bits[pos] = 1;
+        update(energy, pos, 1);
+        ones++;
+      }
+    }
+
+    // spread out the initial pattern
+    for (int i = 0; i < n; i++)
+    {
+      const int cluster = find(energy, bits, 1, true);
+
+      bits[cluster] = 0;
+      update(energy, cluster, -1);
+
+      const int hole = find(energy, bits, 0, false);
+
+      bits[hole] = 1;
+      update(energy, hole, 1);
+
+      if (hole == cluster)
+        break;
+    }
+
+    std::vector<int> rank(n, 0);
+    std::vector<char> temp_bits = bits;
+    std::vector<float> temp_energy = energy;
+
+    // rank the initial points by removing the tightest clusters
+    for (int r = ones - 1; r >= 0; r--)
+    {
+      const int cluster = find(temp_energy, temp_bits, 1, true);
+
+      temp_bits[cluster] = 0;
+      update(temp_energy, cluster, -1);
+      rank[cluster] = r;
+    }
+
+    // rank the remaining points by filling the largest voids
+    for (int r = ones; r < n; r++)
+    {
+      const int hole = find(energy, bits, 0, false);
+
+      bits[hole] = 1;
+      update(energy, hole, 1);
+      rank[hole] = r;
+    }
+
+    matrix.resize(n);
+
+    for (int i = 0; i < n; i++)
+      matrix[i] = (rank[i] + .5f) / n - .5f;
+  }
+}
+
+namespace
+{
+  // average distance between palette entries and their nearest
+  // neighbors, used as the strength of ordered dithering
+  float paletteSpread(Palette *pal, const bool lum_only)
+  {
+    if (pal->max < 2)
+      return 0;
+
+    float total = 0;
+
+    for (int i = 0; i < pal->max; i++)
+    {
+      const rgba_type rgba1 = getRgba(pal->data[i]);
+      int nearest = 255;
+
+      for (int j = 0; j < pal->max; j++)
+      {
+        const rgba_type rgba2 = getRgba(pal->data[j]);
+        int d;
+
+        if (lum_only)
+        {
+          d = std::abs(getl(pal->data[i]) - getl(pal->data[j]));
+        }
+          else
+        {
+          d = std::max(std::abs(rgba1.r - rgba2.r),
+                       std::max(std::abs(rgba1.g - rgba2.g),
+                                std::abs(rgba1.b - rgba2.b)));
+        }
+
+        if (d > 0 && d < nearest)
+          nearest = d;
+      }
+
+      total += nearest;
+    }
+
+    return total / pal->max;
+  }
+
+  // add a threshold offset to a channel, in linear light if requested
+  inline int offsetValue(const int value, const float offset,
+                         const bool fix_gamma)
+  {
+    if (fix_gamma)
+      return Gamma::unfix(clamp(Gamma::fix(value) + offset * 257, 65535));
+    else
+      return clamp(value + offset, 255);
+  }
+
+  // Ordered dithering with a tiled threshold map. Each pixel only
+  // depends on itself, so row bands run in parallel.
+  void ordered(Bitmap *bmp, const std::vector<float> &matrix, const int size,
+               const bool fix_gamma, const bool lum_only)
+  {
+    Palette *pal = Project::palette;
+    const int mask = size - 1;
+    const float spread = paletteSpread(pal, lum_only);
+    const int batch = 256;
+
+    Gui::progressShow(bmp->h);
+
+    for (int y1 = bmp->ct; y1 <= bmp->cb; y1 += batch)
+    {
+      const int y2 = std::min(y1 + batch - 1, bmp->cb);
+
+      Threads::run(y1, y2, [&](int, int first, int last)
+      {
+        for (int y = first; y <= last; y++)
+        {
+          const float *t = &matrix[(y & mask) * size];
+          int *p = bmp->row[y] + bmp->cl;
+
+          for (int x = bmp->cl; x <= bmp->cr; x++)
+          {
+            const float offset = t[x & mask] * spread;
+            const rgba_type rgba = getRgba(*p);
+            int c;
+
+            if (lum_only)
+            {
+              const int l = offsetValue(getl(*p), offset, fix_gamma);
+
+              c = Blend::keepLum(*p, l);
+            }
+              else
+            {
+              c = makeRgb(offsetValue(rgba.r, offset, fix_gamma),
+                          offsetValue(rgba.g, offset, fix_gamma),
+                          offsetValue(rgba.b, offset, fix_gamma));
+            }
+
+            const rgba_type use = getRgba(pal->data[pal->lookup(c)]);
+
+            *p++ = makeRgba(use.r, use.g, use.b, rgba.a);
+          }
+        }
+      });
+
+      for (int y = y1; y <= y2; y++)
+      {
+        if (Gui::progressUpdate(y) < 0)
+          return;
+      }
+    }
+
+    Gui::progressHide();
+  }
+}
+
+// Rows are dithered as a diagonal wavefront: each thread takes every
+// n-th row and follows the row above it at a fixed lag, which gives the
+// same result as a serial scan. Serpentine scanning alternates the row
+// direction, so it has to run on a single thread.
+void Dither::apply(Bitmap *bmp, int mode, bool fix_gamma, bool lum_only,
+                   bool serpentine)
 {
   int (*matrix)[5] = Threshold::matrix;
-  int w = 5, h = 3;
   int div = 1;
 
+  if (mode == BAYER)
+  {
+    if (Bayer::matrix.empty())
+      Bayer::init();
+
+    ordered(bmp, Bayer::matrix, Bayer::size, fix_gamma, lum_only);
+    return;
+  }
+
+  if (mode == BLUE_NOISE)
+  {
+    if (BlueNoise::matrix.empty())
+      BlueNoise::init();
+
+    ordered(bmp, BlueNoise::matrix, BlueNoise::size, fix_gamma, lum_only);
+    return;
+  }
+
   switch (mode)
   {
     case THRESHOLD:
@@ -153,177 +627,56 @@ void Dither::apply(Bitmap *bmp, int mode, bool fix_gamma, bool lum_only)
       break;
   }
 
-  Gui::progressShow(bmp->h);
-
-  if (lum_only)
-  {
-    for (int y = bmp->ct; y <= bmp->cb; y++)
-    {
-      int *p = bmp->row[y] + bmp->cl;
-
-      for (int x = bmp->cl; x <= bmp->cr; x++)
-      {
-        const int alpha = geta(*p);
-        const int old_l = getl(*p);
-        const int pal_index = Project::palette->lookup(Blend::keepLum(*p, old_l));
-        const int cp = Project::palette->data[pal_index];
-
-        rgba_type rgba = getRgba(cp);
-        *p = makeRgba(rgba.r, rgba.g, rgba.b, alpha);
-
-        const int new_l = getl(*p);
-        int el;
-
-        if (fix_gamma)
-        {
-          el = Gamma::fix(old_l) - Gamma::fix(new_l);
-
-          if (el < -16383) el = -16383;
-          if (el > 16383) el = 16383;
-        }
-          else
-        {
-          el = old_l - new_l;
-
-          if (el < -127) el = -127;
-          if (el > 127) el = 127;
-        }
-
-        for (int j = 0; j < h; j++)
-        {
-          for (int i = 0; i < w; i++)
-          {
-            if (matrix[j][i] > 0)
-            {
-              int c = bmp->getpixel(x - w / 2 + i, y + j);
-              int l = getl(c);
+  const int threads = serpentine ? 1 : Threads::count();
+  const int batch = threads * 16;
 
-              if (fix_gamma)
-                l = Gamma::fix(l); 
+  // number of finished columns in each row of the batch
+  std::vector<std::atomic<int> > done(batch);
 
-              l += (el * matrix[j][i]) / div;
+  Gui::progressShow(bmp->h);
 
-              if (fix_gamma)
-                l = Gamma::unfix(clamp(l, 65535));
-              else
-                l = clamp(l, 255);
+  for (int y1 = bmp->ct; y1 <= bmp->cb; y1 += batch)
+  {
+    const int y2 = std::min(y1 + batch - 1, bmp->cb);
 
-              rgba = getRgba(Blend::keepLum(c, l));
+    for (int i = 0; i < batch; i++)
+      done[i] = 0;
 
-              bmp->setpixelSolid(x - w / 2 + i, y + j,
-                               makeRgba(rgba.r, rgba.g, rgba.b, rgba.a), 0);
-            }  
-          }
-        }
-
-        p++;
-      }
-
-      if (Gui::progressUpdate(y) < 0)
-        return;
-    }
-  }
-    else
-  {
-    for (int y = bmp->ct; y <= bmp->cb; y++)
+    Threads::run(0, threads - 1, [&](int band, int, int)
     {
-      int *p = bmp->row[y] + bmp->cl;
-
-      for (int x = bmp->cl; x <= bmp->cr; x++)
+      for (int y = y1 + band; y <= y2; y += threads)
       {
-        rgba_type rgba = getRgba(*p);
-        const int alpha = rgba.a;
-        const int old_r = rgba.r;
-        const int old_g = rgba.g;
-        const int old_b = rgba.b;
+        const int k = y - y1;
 
-        const int pal_index = Project::palette->lookup(*p);
-        const int c = Project::palette->data[pal_index];
-
-        rgba = getRgba(c);
-        *p = makeRgba(rgba.r, rgba.g, rgba.b, alpha);
-
-        const int new_r = rgba.r;
-        const int new_g = rgba.g;
-        const int new_b = rgba.b;
-        int er, eg, eb;
-
-        if (fix_gamma)
+        if (serpentine && ((y - bmp->ct) & 1))
         {
-          er = Gamma::fix(old_r) - Gamma::fix(new_r);
-          eg = Gamma::fix(old_g) - Gamma::fix(new_g);
-          eb = Gamma::fix(old_b) - Gamma::fix(new_b);
-
-          if (er < -16383) er = -16383;
-          if (er > 16383) er = 16383;
-          if (eg < -16383) eg = -16383;
-          if (eg > 16383) eg = 16383;
-          if (eb < -16383) eb = -16383;
-          if (eb > 16383) eb = 16383;
-        }
-          else
-        {
-          er = old_r - new_r;
-          eg = old_g - new_g;
-          eb = old_b - new_b;
-
-          if (er < -127) er = -127;
-          if (er > 127) er = 127;
-          if (eg < -127) eg = -127;
-          if (eg > 127) eg = 127;
-          if (eb < -127) eb = -127;
-          if (eb > 127) eb = 127;
+          for (int x = bmp->cr; x >= bmp->cl; x--)
+            ditherPixel(bmp, x, y, -1, matrix, div, fix_gamma, lum_only);
+
+          done[k].store(bmp->cw, std::memory_order_release);
+          continue;
         }
 
-        for (int j = 0; j < h; j++)
+        for (int x = bmp->cl; x <= bmp->cr; x++)
         {
-          for (int i = 0; i < w; i++)
+          const int col = x - bmp->cl;
+
+          if (k > 0)
           {
-            if (matrix[j][i] > 0)
-            {
-              rgba = getRgba(bmp->getpixel(x - w / 2 + i, y + j));
-              int r, g, b;
-
-              if (fix_gamma)
-              {
-                r = Gamma::fix(rgba.r); 
-                g = Gamma::fix(rgba.g); 
-                b = Gamma::fix(rgba.b);
-              }
-                else
-              {
-                r = rgba.r; 
-                g = rgba.g; 
-                b = rgba.b; 
-              }
-
-              r += (er * matrix[j][i]) / div;
-              g += (eg * matrix[j][i]) / div;
-              b += (eb * matrix[j][i]) / div;
-
-              if (fix_gamma)
-              {
-                r = Gamma::unfix(clamp(r, 65535));
-                g = Gamma::unfix(clamp(g, 65535));
-                b = Gamma::unfix(clamp(b, 65535));
-              }
-                else
-              {
-                r = clamp(r, 255);
-                g = clamp(g, 255);
-                b = clamp(b, 255);
-              }
-
-              bmp->setpixelSolid(x - w / 2 + i, y + j,
-                               makeRgba(r, g, b, rgba.a), 0);
-            }  
+            const int need = std::min(col + lag, bmp->cw);
+
+            while (done[k - 1].load(std::memory_order_acquire) < need)
+              std::this_thread::yield();
           }
 
+          ditherPixel(bmp, x, y, 1, matrix, div, fix_gamma, lum_only);
+          done[k].store(col + 1, std::memory_order_release);
         }
-
-        p++;
       }
+    });
 
+    for (int y = y1; y <= y2; y++)
+    {
       if (Gui::progressUpdate(y) < 0)
         return;
     }
@@ -334,24 +687,29 @@ void Dither::apply(Bitmap *bmp, int mode, bool fix_gamma, bool lum_only)
 
 void Dither::close()
 {
+  Preview::end();
   Items::dialog->hide();
   Project::undo->push();
 
   const int mode = Items::mode->value();
   const bool fix_gamma = Items::gamma->value();
   const bool lum_only = Items::lum_only->value();
+  const bool serpentine = Items::serpentine->value();
 
-  apply(Project::bmp, mode, fix_gamma, lum_only);
+  apply(Project::bmp, mode, fix_gamma, lum_only, serpentine);
 }
 
 void Dither::quit()
 {
+  Preview::end();
   Gui::progressHide();
   Items::dialog->hide();
 }
 
 void Dither::begin()
 {
+  Preview::begin(Items::preview);
+  preview();
   Items::dialog->show();
 }
 
@@ -362,6 +720,8 @@ void Dither::init()
   int hh = 0;
 
   Items::dialog = new DialogWindow(256, 0, "Apply Colors");
+  Items::preview = new Widget(Items::dialog, 8, y1, 240, 240, 0, 1, 1, 0);
+  y1 += 240 + 8;
   Items::mode = new Fl_Choice(0, y1, 128, 24, "Dither:");
   Items::mode->tooltip("Dither Mode");
   Items::mode->textsize(10);
@@ -371,16 +731,22 @@ void Dither::init()
   Items::mode->add("Stucki");
   Items::mode->add("Atkinson");
   Items::mode->add("Sierra");
+  Items::mode->add("Ordered (Bayer)");
+  Items::mode->add("Ordered (Blue Noise)");
   Items::mode->value(0);
+  Items::mode->callback((Fl_Callback *)preview);
   Items::mode->measure_label(ww, hh);
   Items::mode->resize(Items::dialog->x() + Items::dialog->w() / 2 - (Items::mode->w() + ww) / 2 + ww, Items::mode->y(), Items::mode->w(), Items::mode->h());
   y1 += 24 + 8;
-  Items::gamma = new CheckBox(Items::dialog, 0, y1, 16, 16, "Gamma Correction", 0);
+  Items::gamma = new CheckBox(Items::dialog, 0, y1, 16, 16, "Gamma Correction", (Fl_Callback *)preview);
   Items::gamma->center();
   y1 += 16 + 8;
-  Items::lum_only = new CheckBox(Items::dialog, 0, y1, 16, 16, "Luminosity Based", 0);
+  Items::lum_only = new CheckBox(Items::dialog, 0, y1, 16, 16, "Luminosity Based", (Fl_Callback *)preview);
   Items::lum_only->center();
   y1 += 16 + 8;
+  Items::serpentine = new CheckBox(Items::dialog, 0, y1, 16, 16, "Serpentine Scan", (Fl_Callback *)preview);
+  Items::serpentine->center();
+  y1 += 16 + 8;
   Items::dialog->addOkCancelButtons(&Items::ok, &Items::cancel, &y1);
   Items::ok->callback((Fl_Callback *)close);
   Items::cancel->callback((Fl_Callback *)quit);
@@ -388,3 +754,16 @@ void Dither::init()
   Items::dialog->end();
 }
 
+void Dither::preview()
+{
+  const int mode = Items::mode->value();
+  const bool fix_gamma = Items::gamma->value();
+  const bool lum_only = Items::lum_only->value();
+  const bool serpentine = Items::serpentine->value();
+
+  Preview::update([=](Bitmap *bmp, float)
+  {
+    apply(bmp, mode, fix_gamma, lum_only, serpentine);
+  });
+}
+
@@ -22,70 +22,26 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
 
 void Equalize::apply(Bitmap *bmp)
 {
-  std::vector<int> list_r(256, 0);
-  std::vector<int> list_g(256, 0);
-  std::vector<int> list_b(256, 0);
+  ChannelHistogram hist;
 
-  const int size = bmp->cw * bmp->ch;
+  hist.build(bmp, false);
 
-  for (int y = bmp->ct; y <= bmp->cb; y++)
+  const std::vector<int> list[3] =
   {
-    int *p = bmp->row[y] + bmp->cl;
+    hist.cumulative(ChannelHistogram::RED),
+    hist.cumulative(ChannelHistogram::GREEN),
+    hist.cumulative(ChannelHistogram::BLUE)
+  };
 
-    for (int x = bmp->cl; x <= bmp->cr; x++)
-    {
-      rgba_type rgba = getRgba(*p);
+  const double scale = 255.0 / hist.total;
+  ColorLut lut;
 
-      const int r = rgba.r;
-      const int g = rgba.g;
-      const int b = rgba.b;
-
-      list_r[r]++;
-      list_g[g]++;
-      list_b[b]++;
-      p++;
-    }
-  }
-
-  for (int j = 255; j >= 0; j--)
-  {
-    for (int i = 0; i < j; i++)
-    {
-      list_r[j] += list_r[i];
-      list_g[j] += list_g[i];
-      list_b[j] += list_b[i];
-    }
-  }
-
-  const double scale = 255.0 / size;
-
-  Gui::progressShow(bmp->h);
-
-  for (int y = bmp->ct; y <= bmp->cb; y++)
+  lut.compileChannels([&](int channel, int value)
   {
-    int *p = bmp->row[y] + bmp->cl;
-
-    for (int x = bmp->cl; x <= bmp->cr; x++)
-    {
-      rgba_type rgba = getRgba(*p);
-
-      int r = rgba.r;
-      int g = rgba.g;
-      int b = rgba.b;
-
-      r = list_r[r] * scale;
-      g = list_g[g] * scale;
-      b = list_b[b] * scale;
-
-      *p = makeRgba(r, g, b, rgba.a);
-      p++;
-    }
-
-    if (Gui::progressUpdate(y) < 0)
-      return;
-  }
+    return (int)(list[channel][value] * scale);
+  });
 
-  Gui::progressHide();
+  lut.apply(bmp, true);
 }
 
 void Equalize::begin()
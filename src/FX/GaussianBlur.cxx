@@ -22,59 +22,23 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
 Fast gaussian blur based on the idea of using an "accumulator" I learned
 about here: https://blog.ivank.net/fastest-gaussian-blur.html
 
-My implementation only works for sizes >= 3, so a box filter is used
-for 1 & 2 instead.
+The image is converted once to 16-bit linear light planes, blurred with
+three running-sum box passes in each direction and converted back, so
+the cost doesn't depend on the size. Sizes 1 & 2 use one or two [1 2 1]
+passes instead, made from a pair of 2-pixel boxes.
 */
 
-#include "GaussianBlur.H"
-
-namespace
-{
-  // extends borders so edges are handled correctly
-  void extendBorders(Bitmap *bmp, int border)
-  {
-    const int cl = border;
-    const int cr = bmp->w - border - 1;
-    const int ct = border;
-    const int cb = bmp->h - border - 1;
-    const int w = bmp->w;
-    const int h = bmp->h;
-
-    // left
-    for (int y = ct; y <= cb; y++)
-      bmp->hline(0, y, cl - 1, bmp->getpixel(cl, y));
-
-    // right
-    for (int y = ct; y <= cb; y++)
-      bmp->hline(cr + 1, y, w - 1, bmp->getpixel(cr, y));
-
-    // top
-    for (int x = cl; x <= cr; x++)
-      bmp->vline(0, x, ct - 1, bmp->getpixel(x, ct));
-
-    // bottom
-    for (int x = cl; x <= cr; x++)
-      bmp->vline(cb + 1, x, h - 1, bmp->getpixel(x, cb));
+#include <algorithm>
 
-    // upper-left
-    bmp->rectfill(0, 0, cl - 1, ct - 1, bmp->getpixel(cl, ct));
-
-    // upper-right
-    bmp->rectfill(cr, 0, w - 1, ct - 1, bmp->getpixel(cr, ct));
-
-    // lower-left
-    bmp->rectfill(0, cb + 1, cl - 1, h - 1, bmp->getpixel(cl, cb));
-
-    // lower-right
-    bmp->rectfill(cr + 1, cb + 1, w - 1, h - 1, bmp->getpixel(cr, cb));
-  }
-}
+#include "GaussianBlur.H"
+#include "LinearBitmap.H"
 
 namespace
 {
   namespace Items
   {
     DialogWindow *dialog;
+    Widget *preview;
     InputInt *size;
     InputInt *blend;
     Fl_Choice *mode;
@@ -92,235 +56,91 @@ void GaussianBlur::apply(Bitmap *bmp, float size, int blend, int mode)
     size = 1;
   }
 
-  const int border = 128;
-  const int matrix[9] = { 0, 1, 0, 1, 2, 1, 0, 1, 0 };
-
-  // make copy, extend borders
-  Bitmap src(bmp->w + border * 2, bmp->h + border * 2);
-  bmp->blit(&src, 0, 0, border, border, bmp->w, bmp->h);
-  extendBorders(&src, border);
-
-  Bitmap temp(src.w, src.h);
-  src.blit(&temp, 0, 0, 0, 0, src.w, src.h);
+  // box sizes and left extents of each pass
+  std::vector<int> box_size;
+  std::vector<int> box_lo;
 
-  // use alternative blur for sizes 1 & 2
   if (size < 3)
   {
-    Gui::progressShow(bmp->h);
-
     for (int pass = 0; pass < size; pass++)
     {
-      for (int y = bmp->ct; y <= bmp->cb; y++)
-      {
-        for (int x = bmp->cl; x <= bmp->cr; x++)
-        {
-          int r = 0;
-          int g = 0;
-          int b = 0;
-          int a = 0;
-
-          for (int i = 0; i < 9; i++)
-          {
-            const rgba_type rgba = getRgba(bmp->getpixel(x + i % 3 - 1,
-                                                         y + i / 3 - 1));
-
-            r += Gamma::fix(rgba.r) << matrix[i];
-            g += Gamma::fix(rgba.g) << matrix[i];
-            b += Gamma::fix(rgba.b) << matrix[i];
-            a += rgba.a;
-          }
-
-          r >>= 4;
-          g >>= 4;
-          b >>= 4;
-          a /= 9;
-
-          r = Gamma::unfix(r);
-          g = Gamma::unfix(g);
-          b = Gamma::unfix(b);
-
-          const int c1 = src.getpixel(x + border, y + border);
-          const int c2 = makeRgba(r, g, b, a);
-
-          switch (mode)
-          {
-            case 0:
-              temp.setpixel(x + border, y + border,
-                            Blend::trans(c1, c2, 0));
-              break;
-            case 1:
-              temp.setpixel(x + border, y + border,
-                Blend::trans(c1, Blend::keepLum(c2, getl(c1)), 0));
-              break;
-            case 2:
-              temp.setpixel(x + border, y + border,
-                            Blend::transAlpha(c1, c2, 0));
-              break;
-          }
-        }
-
-        if (Gui::progressUpdate(y) < 0)
-          break;
-      }
+      box_size.push_back(2);
+      box_lo.push_back(1);
+      box_size.push_back(2);
+      box_lo.push_back(0);
     }
+  }
+    else
+  {
+    // force odd value to prevent image shift
+    if (((int)size & 1) == 0)
+      size += 1;
 
-    for (int y = 0; y < bmp->h; y++)
+    for (int pass = 0; pass < 3; pass++)
     {
-      for (int x = 0; x < bmp->w; x++)
-      {
-        bmp->setpixelSolid(x, y, temp.getpixel(border + x, border + y), blend);
-      }
+      box_size.push_back(size);
+      box_lo.push_back((int)size / 2);
     }
-  
-    Gui::progressHide();
-    return;
   }
 
-  if (size > border / 2 - 2)
-    size = border / 2 - 2;
-
-  // force odd value to prevent image shift
-  if (((int)size & 1) == 0)
-    size += 1;
-
-  int larger = src.w > src.h ? src.w : src.h;
-
-  std::vector<int> buf_r(larger, 0);
-  std::vector<int> buf_g(larger, 0);
-  std::vector<int> buf_b(larger, 0);
-  std::vector<int> buf_a(larger, 0);
-
-  Gui::progressShow(6, 1);
+  Gui::progressShow(box_size.size() * 2 + 2, 1);
 
   int pass_count = 0;
 
-  for (int pass = 0; pass < 3; pass++)
-  {
-    // x direction
-    if (Gui::progressUpdate(pass_count++))
-      break;
-
-    for (int y = src.ct; y <= src.cb; y++)
-    {
-      for (int x = 0; x < src.w; x++)
-      {
-        rgba_type rgba = getRgba(src.getpixel(x, y));
-        buf_r[x] = Gamma::fix(rgba.r);
-        buf_g[x] = Gamma::fix(rgba.g);
-        buf_b[x] = Gamma::fix(rgba.b);
-        buf_a[x] = rgba.a;
-      }
-
-      int accum_r = 0;
-      int accum_g = 0;
-      int accum_b = 0;
-      int accum_a = 0;
-      int div = 1;
-
-      for (int x = src.cl; x <= src.cr; x++)
-      {
-        const int mx = x - div;
-
-        if (mx >= 0)
-        {
-          accum_r -= buf_r[mx];
-          accum_g -= buf_g[mx];
-          accum_b -= buf_b[mx];
-          accum_a -= buf_a[mx];
-        }
+  LinearBitmap linear(bmp->cw, bmp->ch);
+  linear.fromBitmap(bmp, bmp->cl, bmp->ct);
 
-        accum_r += buf_r[x];
-        accum_g += buf_g[x];
-        accum_b += buf_b[x];
-        accum_a += buf_a[x];
-
-        div++;
+  for (int pass = 0; pass < (int)box_size.size(); pass++)
+  {
+    if (Gui::progressUpdate(pass_count++) < 0)
+      return;
 
-        if (div > size)
-          div = size;
+    linear.boxBlurX(box_size[pass], box_lo[pass]);
 
-        const int c = makeRgba(Gamma::unfix(accum_r / div),
-                               Gamma::unfix(accum_g / div),
-                               Gamma::unfix(accum_b / div),
-                               accum_a / div);
+    if (Gui::progressUpdate(pass_count++) < 0)
+      return;
 
-        temp.setpixel(x - size / 2 + 1, y - size / 2 + 1, c);
-      }
-    }
+    linear.boxBlurY(box_size[pass], box_lo[pass]);
+  }
 
-    // y direction
-    if (Gui::progressUpdate(pass_count++))
-      break;
+  if (Gui::progressUpdate(pass_count++) < 0)
+    return;
 
-    for (int x = src.cl; x <= src.cr; x++)
+  Threads::run(bmp->ct, bmp->cb, [&](int, int first, int last)
+  {
+    for (int y = first; y <= last; y++)
     {
-      for (int y = 0; y < src.h; y++)
-      {
-        rgba_type rgba = getRgba(temp.getpixel(x, y));
-        buf_r[y] = Gamma::fix(rgba.r);
-        buf_g[y] = Gamma::fix(rgba.g);
-        buf_b[y] = Gamma::fix(rgba.b);
-        buf_a[y] = rgba.a;
-      }
-
-      int accum_r = 0;
-      int accum_g = 0;
-      int accum_b = 0;
-      int accum_a = 0;
-      int div = 1;
+      int *p = bmp->row[y] + bmp->cl;
 
-      for (int y = src.ct; y <= src.cb; y++)
+      for (int x = 0; x < bmp->cw; x++)
       {
-        const int my = y - div;
-
-        if (my >= 0)
-        {
-          accum_r -= buf_r[my];
-          accum_g -= buf_g[my];
-          accum_b -= buf_b[my];
-          accum_a -= buf_a[my];
-        }
-
-        accum_r += buf_r[y];
-        accum_g += buf_g[y];
-        accum_b += buf_b[y];
-        accum_a += buf_a[y];
-
-        div++;
-
-        if (div > size)
-          div = size;
-
-        int c1 = src.getpixel(x, y);
-
-        const int c2 = makeRgba(Gamma::unfix(accum_r / div),
-                                Gamma::unfix(accum_g / div),
-                                Gamma::unfix(accum_b / div),
-                                accum_a / div);
+        const int c1 = *p;
+        const int c2 = linear.getpixel(x, y - bmp->ct);
 
         switch (mode)
         {
           case 0:
-            src.setpixel(x, y, Blend::trans(c1, c2, blend));
+            *p = Blend::trans(c1, c2, blend);
             break;
           case 1:
-            src.setpixel(x, y,
-              Blend::trans(c1, Blend::keepLum(c2, getl(c1)), blend));
+            *p = Blend::trans(c1, Blend::keepLum(c2, getl(c1)), blend);
             break;
           case 2:
-            src.setpixel(x, y, Blend::transAlpha(c1, c2, blend));
+            *p = Blend::transAlpha(c1, c2, blend);
             break;
         }
+
+        p++;
       }
     }
-  }
+  });
 
-  src.blit(bmp, border, border, 0, 0, bmp->w, bmp->h);
   Gui::progressHide();
 }
 
 void GaussianBlur::close()
 {
+  Preview::end();
   Items::dialog->hide();
   Project::undo->push();
 
@@ -333,12 +153,15 @@ void GaussianBlur::close()
 
 void GaussianBlur::quit()
 {
+  Preview::end();
   Gui::progressHide();
   Items::dialog->hide();
 }
 
 void GaussianBlur::begin()
 {
+  Preview::begin(Items::preview);
+  preview();
   Items::dialog->show();
 }
 
@@ -349,13 +172,15 @@ void GaussianBlur::init()
   int hh = 0;
 
   Items::dialog = new DialogWindow(256, 0, "Gaussian Blur");
+  Items::preview = new Widget(Items::dialog, 8, y1, 240, 240, 0, 1, 1, 0);
+  y1 += 240 + 8;
 
-  Items::size = new InputInt(Items::dialog, 0, y1, 96, 24, "Size (1-60)", 0, 1, 60);
+  Items::size = new InputInt(Items::dialog, 0, y1, 96, 24, "Size (1-60)", (Fl_Callback *)preview, 1, 60);
   y1 += 24 + 8;
   Items::size->value("1");
   Items::size->center();
 
-  Items::blend = new InputInt(Items::dialog, 0, y1, 96, 24, "Blend %", 0, 0, 100);
+  Items::blend = new InputInt(Items::dialog, 0, y1, 96, 24, "Blend %", (Fl_Callback *)preview, 0, 100);
   Items::blend->value("100");
   Items::blend->center();
   y1 += 24 + 8;
@@ -367,6 +192,7 @@ void GaussianBlur::init()
   Items::mode->add("Color Only");
   Items::mode->add("Alpha Only");
   Items::mode->value(0);
+  Items::mode->callback((Fl_Callback *)preview);
   Items::mode->align(FL_ALIGN_LEFT);
   Items::mode->measure_label(ww, hh);
   Items::mode->resize(Items::dialog->x() + Items::dialog->w() / 2
@@ -381,3 +207,15 @@ void GaussianBlur::init()
   Items::dialog->end();
 }
 
+void GaussianBlur::preview()
+{
+  const float size = atof(Items::size->value());
+  const int blend = 255 - atoi(Items::blend->value()) * 2.55;
+  const int mode = Items::mode->value();
+
+  Preview::update([=](Bitmap *bmp, float scale)
+  {
+    apply(bmp, std::max(1.0f, size * scale), blend, mode);
+  });
+}
+
@@ -40,7 +40,7 @@ namespace
     Fl_Button *ok;
     Fl_Button *cancel;
 
-    Bitmap *temp;
+    int seed;
     int old_marb_var;
     int old_turb_var;
     int old_blend_var;
@@ -48,27 +48,32 @@ namespace
   }
 }
 
-void Marble::apply(Bitmap *dest)
+// The pattern depends only on the settings and seed, at any size, so a
+// preview made on a smaller copy looks like the final result. scale is
+// the size of the bitmap relative to the image.
+void Marble::apply(Bitmap *dest, int marb, int turb, int blend,
+                   int threshold, int type, int mode, int color, int seed,
+                   float scale)
 {
-  int w = dest->cw;
-  int h = dest->ch;
+  const int w = dest->cw;
+  const int h = dest->ch;
 
   Map plasma(w, h);
   Map marble(w, h);
   Map marbx(w, h);
   Map marby(w, h);
 
-  Fractal::plasma(&plasma, (Items::turb->var + 1) << 10);
-  Fractal::plasma(&marbx, (Items::turb->var + 1) << 10);
-  Fractal::plasma(&marby, (Items::turb->var + 1) << 10);
-  Fractal::marble(&plasma, &marble, &marbx, &marby, (Items::marb->var + 1) << 2, 50, Items::type->value());
+  Fractal::plasma(&plasma, (turb + 1) << 10, seed);
+  Fractal::plasma(&marbx, (turb + 1) << 10, seed + 1);
+  Fractal::plasma(&marby, (turb + 1) << 10, seed + 2);
+  Fractal::marble(&plasma, &marble, &marbx, &marby,
+                  ((marb + 1) << 2) * scale, 50, type);
 
-  int color = Project::brush->color;
-  int trans = Items::blend->var * 10.96;
-  int threshold = Items::threshold->var * 10.96;
+  const int trans = blend * 10.96;
+  const int thresh = threshold * 10.96;
   int (*current_blend)(const int, const int, const int) = &Blend::trans;
 
-  switch (Items::mode->value())
+  switch (mode)
   {
     case 1:
       current_blend = &Blend::lighten;
@@ -80,53 +85,55 @@ void Marble::apply(Bitmap *dest)
       current_blend = &Blend::trans;
       break;
   }
-  
-  for (int y = 0; y < h; y++)
-  {
-    int *p = dest->row[y + dest->ct] + dest->cl;
 
-    for (int x = 0; x < w; x++)
+  Threads::run(0, h - 1, [&](int, int first, int last)
+  {
+    for (int y = first; y <= last; y++)
     {
-      int mix = marble.getpixel(x, y) - threshold;
+      const unsigned char *m = marble.row[y];
+      int *p = dest->row[y + dest->ct] + dest->cl;
+
+      for (int x = 0; x < w; x++)
+      {
+        int mix = m[x] - thresh;
 
-      if (mix < 0)
-        mix = 0;
+        if (mix < 0)
+          mix = 0;
 
-      if (Items::type->value() == 1)
-        *p = current_blend(*p, color, (scaleVal(trans, 255 - mix) & 63) * 4);
-      else
-        *p = current_blend(*p, color, scaleVal(trans, 255 - mix));
+        if (type == 1)
+          *p = current_blend(*p, color, (scaleVal(trans, 255 - mix) & 63) * 4);
+        else
+          *p = current_blend(*p, color, scaleVal(trans, 255 - mix));
 
-      p++;
+        p++;
+      }
     }
-  }
+  });
 }
 
 void Marble::close()
 {
-  Bitmap *bmp = Project::bmp;
-  Items::temp->blit(bmp, 0, 0, bmp->cl, bmp->ct, Items::temp->w, Items::temp->h);
+  Preview::end();
   Items::dialog->hide();
+  Project::undo->push();
+  apply(Project::bmp, Items::marb->var, Items::turb->var, Items::blend->var,
+        Items::threshold->var, Items::type->value(), Items::mode->value(),
+        Project::brush->color, Items::seed, 1);
   Gui::getView()->drawMain(true);
-  delete Items::temp;
 }
 
 void Marble::quit()
 {
+  Preview::end();
   Gui::progressHide();
   Items::dialog->hide();
-  delete Items::temp;
 }
 
 void Marble::begin()
 {
-  Bitmap *bmp = Project::bmp;
-  Project::undo->push();
-  Items::temp = new Bitmap(bmp->cw, bmp->ch);
-  bmp->blit(Items::temp, bmp->cl, bmp->ct, 0, 0, bmp->cw, bmp->ch);
-  apply(Items::temp);
-  FX::drawPreview(Items::temp, Items::preview->bitmap);
-  Items::preview->redraw();
+  Items::seed = rnd();
+  Preview::begin(Items::preview);
+  update();
   Items::color->bitmap->clear(Project::brush->color);
   Items::color->bitmap->rect(0, 0, Items::color->bitmap->w - 1, Items::color->bitmap->h - 1, makeRgb(0, 0, 0), 0);
   Items::color->redraw();
@@ -195,7 +202,7 @@ void Marble::init()
   y1 += 24 + 8;
   Items::change = new Fl_Button(8, y1 + 8, 96, 24, "Randomize");
   Items::change->labelsize(12);
-  Items::change->callback((Fl_Callback *)update);
+  Items::change->callback((Fl_Callback *)randomize);
   Items::dialog->addOkCancelButtons(&Items::ok, &Items::cancel, &y1);
   Items::ok->callback((Fl_Callback *)close);
   Items::cancel->callback((Fl_Callback *)quit);
@@ -205,11 +212,25 @@ void Marble::init()
 
 void Marble::update()
 {
-  Bitmap *bmp = Project::bmp;
-  bmp->blit(Items::temp, bmp->cl, bmp->ct, 0, 0, bmp->cw, bmp->ch);
-  apply(Items::temp);
-  FX::drawPreview(Items::temp, Items::preview->bitmap);
-  Items::preview->redraw();
+  const int marb = Items::marb->var;
+  const int turb = Items::turb->var;
+  const int blend = Items::blend->var;
+  const int threshold = Items::threshold->var;
+  const int type = Items::type->value();
+  const int mode = Items::mode->value();
+  const int color = Project::brush->color;
+  const int seed = Items::seed;
+
+  Preview::update([=](Bitmap *bmp, float scale)
+  {
+    apply(bmp, marb, turb, blend, threshold, type, mode, color, seed, scale);
+  });
+}
+
+void Marble::randomize()
+{
+  Items::seed = rnd();
+  update();
 }
 
 void Marble::setMarb()
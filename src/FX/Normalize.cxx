@@ -20,80 +20,48 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
 
 #include "Normalize.H"
 
-void Normalize::apply(Bitmap *bmp)
+// Builds the table for an image whose colors are first passed through
+// input, so this can follow other color changes in a Chain.
+void Normalize::compile(ColorLut *lut, Bitmap *bmp, const ColorLut &input)
 {
   // search for highest & lowest RGB values
-  int r_high = 0;
-  int g_high = 0;
-  int b_high = 0;
-  int r_low = 0xffffff;
-  int g_low = 0xffffff;
-  int b_low = 0xffffff;
-
-  for (int y = bmp->ct; y <= bmp->cb; y++)
+  ChannelHistogram hist;
+
+  hist.build(bmp, false, input);
+
+  int low[3];
+  int high[3];
+
+  for (int i = 0; i < 3; i++)
   {
-    int *p = bmp->row[y] + bmp->cl;
-
-    for (int x = bmp->cl; x <= bmp->cr; x++)
-    {
-      rgba_type rgba = getRgba(*p);
-
-      const int r = rgba.r;
-      const int g = rgba.g;
-      const int b = rgba.b;
-
-      if (r < r_low)
-        r_low = r;
-      if (r > r_high)
-        r_high = r;
-      if (g < g_low)
-        g_low = g;
-      if (g > g_high)
-        g_high = g;
-      if (b < b_low)
-        b_low = b;
-      if (b > b_high)
-        b_high = b;
-
-      p++;
-    }
+    low[i] = hist.low(i);
+    high[i] = hist.high(i);
   }
 
-  if (!(r_high - r_low))
-    r_high++;
-  if (!(g_high - g_low))
-    g_high++;
-  if (!(b_high - b_low))
-    b_high++;
+  double scale[3];
 
   // scale image
-  double r_scale = 255.0 / (r_high - r_low);
-  double g_scale = 255.0 / (g_high - g_low);
-  double b_scale = 255.0 / (b_high - b_low);
-
-  Gui::progressShow(bmp->h);
-
-  for (int y = bmp->ct; y <= bmp->cb; y++)
+  for (int i = 0; i < 3; i++)
   {
-    int *p = bmp->row[y] + bmp->cl;
-
-    for (int x = bmp->cl; x <= bmp->cr; x++)
-    {
-      rgba_type rgba = getRgba(*p);
+    if (!(high[i] - low[i]))
+      high[i]++;
 
-      const int r = (rgba.r - r_low) * r_scale;
-      const int g = (rgba.g - g_low) * g_scale;
-      const int b = (rgba.b - b_low) * b_scale;
+    scale[i] = 255.0 / (high[i] - low[i]);
+  }
 
-      *p = makeRgba(r, g, b, rgba.a);
-      p++;
-    }
+  lut->compileChannels([&](int channel, int value)
+  {
+    return (int)((value - low[channel]) * scale[channel]);
+  });
+}
 
-    if (Gui::progressUpdate(y) < 0)
-      return;
-  }
+void Normalize::apply(Bitmap *bmp)
+{
+  ColorLut identity;
+  ColorLut lut;
 
-  Gui::progressHide();
+  compile(&lut, bmp, identity);
+  lut.apply(bmp, true);
 }
 
 void Normalize::begin()
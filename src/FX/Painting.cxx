@@ -18,6 +18,11 @@ along with Rendera; if not, write to the Free Software
 Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
 */
 
+#include <algorithm>
+#include <cfloat>
+#include <stdint.h>
+#include <vector>
+
 #include "Painting.H"
 
 namespace
@@ -25,65 +30,143 @@ namespace
   namespace Items
   {
     DialogWindow *dialog;
+    Widget *preview;
     InputInt *amount;
     Fl_Button *ok;
     Fl_Button *cancel;
   }
+
+  // Sums red, green, blue and r^2 + g^2 + b^2 over a box (inclusive)
+  // using a summed area table. The table is unsigned and may wrap, but
+  // the difference for a single window never overflows.
+  inline void boxSum(const std::vector<uint32_t> &table, const int stride,
+                     const int x1, const int y1, const int x2, const int y2,
+                     uint32_t *sum)
+  {
+    const uint32_t *a = &table[y1 * stride + x1 * 4];
+    const uint32_t *b = &table[y1 * stride + (x2 + 1) * 4];
+    const uint32_t *c = &table[(y2 + 1) * stride + x1 * 4];
+    const uint32_t *d = &table[(y2 + 1) * stride + (x2 + 1) * 4];
+
+    for (int i = 0; i < 4; i++)
+      sum[i] = d[i] - b[i] - c[i] + a[i];
+  }
 }
 
-void Painting::apply()
+// Kuwahara filter: each pixel takes the average color of whichever of
+// the four quadrants around it has the lowest variance. Quadrant sums
+// come from a summed area table, so the cost does not depend on the
+// amount.
+void Painting::apply(Bitmap *bmp, int amount)
 {
-  Bitmap *bmp = Project::bmp;
-  int amount = atoi(Items::amount->value());
+  const int w = bmp->cw;
+  const int h = bmp->ch;
+  const int stride = (w + 1) * 4;
+
+  std::vector<uint32_t> table(stride * (h + 1), 0);
 
   Gui::progressShow(bmp->h);
 
-  for (int y = bmp->ct; y <= bmp->cb; y++)
+  // running sums along rows
+  Threads::run(0, h - 1, [&](int, int first, int last)
   {
-    int *p = bmp->row[y] + bmp->cl;
+    for (int y = first; y <= last; y++)
+    {
+      const int *p = bmp->row[bmp->ct + y] + bmp->cl;
+      uint32_t *t = &table[(y + 1) * stride + 4];
+      uint32_t sum[4] = { 0, 0, 0, 0 };
+
+      for (int x = 0; x < w; x++)
+      {
+        const rgba_type rgba = getRgba(*p++);
 
-    for (int x = bmp->cl; x <= bmp->cr; x++)
+        sum[0] += rgba.r;
+        sum[1] += rgba.g;
+        sum[2] += rgba.b;
+        sum[3] += rgba.r * rgba.r + rgba.g * rgba.g + rgba.b * rgba.b;
+
+        for (int i = 0; i < 4; i++)
+          *t++ = sum[i];
+      }
+    }
+  });
+
+  // then down columns
+  Threads::run(1, w, [&](int, int first, int last)
+  {
+    for (int y = 2; y <= h; y++)
     {
-      int r = 0;
-      int g = 0;
-      int b = 0;
-      int count = 0;
+      const uint32_t *above = &table[(y - 1) * stride + first * 4];
+      uint32_t *t = &table[y * stride + first * 4];
+      const int count = (last - first + 1) * 4;
+
+      for (int i = 0; i < count; i++)
+        t[i] += above[i];
+    }
+  });
+
+  const int batch = 256;
 
-      for (int j = -amount; j <= amount; j++) 
+  for (int y1 = 0; y1 < h; y1 += batch)
+  {
+    const int y2 = std::min(y1 + batch - 1, h - 1);
+
+    Threads::run(y1, y2, [&](int, int first, int last)
+    {
+      for (int y = first; y <= last; y++)
       {
-        for (int i = -amount; i <= amount; i++) 
+        int *p = bmp->row[bmp->ct + y] + bmp->cl;
+        const int top = std::max(y - amount, 0);
+        const int bottom = std::min(y + amount, h - 1);
+        const int qy1[4] = { top, top, y, y };
+        const int qy2[4] = { y, y, bottom, bottom };
+
+        for (int x = 0; x < w; x++)
         {
-          const int c3 = *p;
-          const int c1 = bmp->getpixel(x + i, y + j);
-          const int c2 = bmp->getpixel(x - i, y - j);
+          const int left = std::max(x - amount, 0);
+          const int right = std::min(x + amount, w - 1);
+          const int qx1[4] = { left, x, left, x };
+          const int qx2[4] = { x, right, x, right };
 
-          if (diff24(c3, c1) < diff24(c3, c2))
-          {
-            r += getr(c1);
-            g += getg(c1);
-            b += getb(c1);
-          }
-            else
+          float best = FLT_MAX;
+          float r = 0;
+          float g = 0;
+          float b = 0;
+
+          for (int q = 0; q < 4; q++)
           {
-            r += getr(c2);
-            g += getg(c2);
-            b += getb(c2);
+            uint32_t sum[4];
+
+            boxSum(table, stride, qx1[q], qy1[q], qx2[q], qy2[q], sum);
+
+            const float div = 1.0f / ((qx2[q] - qx1[q] + 1)
+                                      * (qy2[q] - qy1[q] + 1));
+            const float mr = sum[0] * div;
+            const float mg = sum[1] * div;
+            const float mb = sum[2] * div;
+            const float var = sum[3] * div - (mr * mr + mg * mg + mb * mb);
+
+            if (var < best)
+            {
+              best = var;
+              r = mr;
+              g = mg;
+              b = mb;
+            }
           }
 
-          count++;
+          *p = makeRgba((int)(r + 0.5f), (int)(g + 0.5f), (int)(b + 0.5f),
+                        geta(*p));
+          p++;
         }
       }
+    });
 
-      r /= count;
-      g /= count;
-      b /= count;
-
-      *p = makeRgba(r, g, b, geta(*p));
-      p++;
+    for (int y = y1; y <= y2; y++)
+    {
+      if (Gui::progressUpdate(bmp->ct + y) < 0)
+        return;
     }
-
-    if (Gui::progressUpdate(y) < 0)
-      return;
   }
 
   Gui::progressHide();
@@ -91,19 +174,24 @@ void Painting::apply()
 
 void Painting::close()
 {
-    Items::dialog->hide();
-    Project::undo->push();
-    apply();
+  Preview::end();
+  Items::dialog->hide();
+  Project::undo->push();
+
+  apply(Project::bmp, atoi(Items::amount->value()));
 }
 
 void Painting::quit()
 {
+  Preview::end();
   Gui::progressHide();
   Items::dialog->hide();
 }
 
 void Painting::begin()
 {
+  Preview::begin(Items::preview);
+  preview();
   Items::dialog->show();
 }
 
@@ -112,7 +200,9 @@ void Painting::init()
   int y1 = 8;
 
   Items::dialog = new DialogWindow(256, 0, "Painting");
-  Items::amount = new InputInt(Items::dialog, 0, y1, 96, 24, "Amount (1-10)", 0, 1, 10);
+  Items::preview = new Widget(Items::dialog, 8, y1, 240, 240, 0, 1, 1, 0);
+  y1 += 240 + 8;
+  Items::amount = new InputInt(Items::dialog, 0, y1, 96, 24, "Amount (1-10)", (Fl_Callback *)preview, 1, 10);
   y1 += 24 + 8;
   Items::amount->value("3");
   Items::amount->center();
@@ -123,3 +213,13 @@ void Painting::init()
   Items::dialog->end();
 }
 
+void Painting::preview()
+{
+  const int amount = atoi(Items::amount->value());
+
+  Preview::update([=](Bitmap *bmp, float scale)
+  {
+    apply(bmp, std::max(1, (int)(amount * scale + .5f)));
+  });
+}
+
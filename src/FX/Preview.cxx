@@ -0,0 +1,219 @@
+/*
+Copyright (c) 2024 Joe Davisson.
+
+This file is part of Rendera.
+
+Rendera is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+Rendera is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Rendera; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+#include <FL/Fl.H>
+
+#include "Preview.H"
+
+namespace
+{
+  // delay after a change before running, and how often to look for
+  // a finished run
+  const double delay = .1;
+  const double poll = .02;
+
+  Widget *widget = 0;
+  Bitmap *proxy = 0;
+  Bitmap *result = 0;
+  float scale = 1;
+
+  std::function<void (Bitmap *, float)> pending;
+  bool waiting = false;
+  bool running = false;
+
+  std::thread worker;
+  std::atomic<bool> done(false);
+  std::atomic<bool> cancel(false);
+  thread_local bool in_worker = false;
+
+  // averages the block of the selection under each proxy pixel
+  void reduce(Bitmap *src, Bitmap *dest)
+  {
+    const int sw = src->cw;
+    const int sh = src->ch;
+
+    Threads::run(0, dest->h - 1, [&](int, int first, int last)
+    {
+      for (int y = first; y <= last; y++)
+      {
+        const int y1 = src->ct + y * sh / dest->h;
+        const int y2 = src->ct + (y + 1) * sh / dest->h - 1;
+        int *p = dest->row[y];
+
+        for (int x = 0; x < dest->w; x++)
+        {
+          const int x1 = src->cl + x * sw / dest->w;
+          const int x2 = src->cl + (x + 1) * sw / dest->w - 1;
+          const int count = (x2 - x1 + 1) * (y2 - y1 + 1);
+          int r = 0, g = 0, b = 0, a = 0;
+
+          for (int j = y1; j <= y2; j++)
+          {
+            const int *s = src->row[j] + x1;
+
+            for (int i = x1; i <= x2; i++)
+            {
+              const rgba_type rgba = getRgba(*s++);
+
+              r += rgba.r;
+              g += rgba.g;
+              b += rgba.b;
+              a += rgba.a;
+            }
+          }
+
+          *p++ = makeRgba(r / count, g / count, b / count, a / count);
+        }
+      }
+    });
+  }
+}
+
+// makes the proxy for the current selection and shows it unchanged
+void Preview::begin(Widget *preview)
+{
+  end();
+
+  Bitmap *bmp = Project::bmp;
+  Bitmap *dest = preview->bitmap;
+  int pw, ph;
+
+  // same fit as FX::drawPreview, but never larger than the selection
+  if (bmp->cw >= bmp->ch)
+  {
+    pw = std::min(dest->w, bmp->cw);
+    ph = std::max(1, pw * bmp->ch / bmp->cw);
+  }
+    else
+  {
+    ph = std::min(dest->h, bmp->ch);
+    pw = std::max(1, ph * bmp->cw / bmp->ch);
+  }
+
+  widget = preview;
+  proxy = new Bitmap(pw, ph);
+  result = new Bitmap(pw, ph);
+  scale = (float)pw / bmp->cw;
+  reduce(bmp, proxy);
+
+  FX::drawPreview(proxy, widget->bitmap);
+  widget->redraw();
+}
+
+// queues the filter to run on the proxy, replacing any earlier request
+void Preview::update(std::function<void (Bitmap *, float)> func)
+{
+  if (proxy == 0)
+    return;
+
+  pending = func;
+  waiting = true;
+  cancel = true;
+
+  Fl::remove_timeout((Fl_Timeout_Handler)start);
+  Fl::add_timeout(delay, (Fl_Timeout_Handler)start);
+}
+
+// cancels any run in progress, call before applying the filter for real
+void Preview::end()
+{
+  Fl::remove_timeout((Fl_Timeout_Handler)start);
+  Fl::remove_timeout((Fl_Timeout_Handler)check);
+  waiting = false;
+
+  if (running)
+  {
+    cancel = true;
+    worker.join();
+    running = false;
+    Gui::progressEnable(true);
+  }
+
+  delete proxy;
+  delete result;
+  proxy = 0;
+  result = 0;
+  widget = 0;
+}
+
+// checked by Gui::progressUpdate() so a superseded run stops early
+bool Preview::cancelled()
+{
+  return in_worker && cancel;
+}
+
+void Preview::start()
+{
+  // let a cancelled run wind down first
+  if (running)
+  {
+    Fl::repeat_timeout(poll, (Fl_Timeout_Handler)start);
+    return;
+  }
+
+  if (waiting == false)
+    return;
+
+  std::function<void (Bitmap *, float)> func = pending;
+  Bitmap *dest = result;
+  const float s = scale;
+
+  waiting = false;
+  cancel = false;
+  done = false;
+  running = true;
+
+  proxy->blit(result, 0, 0, 0, 0, proxy->w, proxy->h);
+
+  // the filter sees progress as disabled, so it won't touch the GUI
+  Gui::progressEnable(false);
+
+  worker = std::thread([func, dest, s]()
+  {
+    in_worker = true;
+    func(dest, s);
+    done = true;
+  });
+
+  Fl::add_timeout(poll, (Fl_Timeout_Handler)check);
+}
+
+void Preview::check()
+{
+  if (done == false)
+  {
+    Fl::repeat_timeout(poll, (Fl_Timeout_Handler)check);
+    return;
+  }
+
+  worker.join();
+  running = false;
+  Gui::progressEnable(true);
+
+  if (cancel == false)
+  {
+    FX::drawPreview(result, widget->bitmap);
+    widget->redraw();
+  }
+}
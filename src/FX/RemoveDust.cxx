@@ -18,6 +18,9 @@ along with Rendera; if not, write to the Free Software
 Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
 */
 
+#include <algorithm>
+#include <vector>
+
 #include "RemoveDust.H"
 
 namespace
@@ -25,58 +28,129 @@ namespace
   namespace Items
   {
     DialogWindow *dialog;
+    Widget *preview;
     Fl_Box *box;
     InputInt *amount;
     CheckBox *invert;
+    CheckBox *in_place;
     Fl_Button *ok;
     Fl_Button *cancel;
   }
 }
 
-void RemoveDust::apply(Bitmap *bmp, int amount)
+// Replaces pixels noticeably darker than the average of their eight
+// neighbours with that average. Normally every pixel is tested against
+// the original image, so the result doesn't depend on scan order and
+// bands of rows run in parallel. In place mode reproduces the original
+// single pass, where a pixel sees the neighbours above and to the left
+// after they have been cleaned.
+void RemoveDust::apply(Bitmap *bmp, int amount, bool in_place)
 {
+  const int w = bmp->cw;
+  const int h = bmp->ch;
+
+  if (w < 3 || h < 3)
+    return;
+
   Gui::progressShow(bmp->h);
 
-  for (int y = bmp->ct + 1; y <= bmp->cb - 1; y++)
+  if (in_place)
   {
-    int *p = bmp->row[y] + bmp->cl + 1;
-
-    for (int x = bmp->cl + 1; x <= bmp->cr - 1; x++)
+    for (int y = bmp->ct + 1; y <= bmp->cb - 1; y++)
     {
-      const int test = *p;
-      int c[8];
-
-      c[0] = bmp->getpixel(x + 1, y);
-      c[1] = bmp->getpixel(x - 1, y);
-      c[2] = bmp->getpixel(x, y + 1);
-      c[3] = bmp->getpixel(x, y - 1);
-      c[4] = bmp->getpixel(x - 1, y - 1);
-      c[5] = bmp->getpixel(x + 1, y - 1);
-      c[6] = bmp->getpixel(x - 1, y + 1);
-      c[7] = bmp->getpixel(x + 1, y + 1);
-
-      int r = 0;
-      int g = 0;
-      int b = 0;
-
-      for (int i = 0; i < 8; i++)
+      const int *above = bmp->row[y - 1] + bmp->cl;
+      const int *below = bmp->row[y + 1] + bmp->cl;
+      int *p = bmp->row[y] + bmp->cl;
+
+      for (int x = 1; x < w - 1; x++)
       {
-        rgba_type rgba = getRgba(c[i]);
-        r += rgba.r;
-        g += rgba.g;
-        b += rgba.b;
+        const int c[8] =
+        {
+          p[x + 1], p[x - 1], below[x], above[x],
+          above[x - 1], above[x + 1], below[x - 1], below[x + 1]
+        };
+
+        int r = 0;
+        int g = 0;
+        int b = 0;
+
+        for (int i = 0; i < 8; i++)
+        {
+          const rgba_type rgba = getRgba(c[i]);
+
+          r += rgba.r;
+          g += rgba.g;
+          b += rgba.b;
+        }
+
+        const int test = p[x];
+        const int avg = makeRgba(r / 8, g / 8, b / 8, geta(test));
+
+        if ((getl(avg) - getl(test)) > amount)
+          p[x] = avg;
       }
 
-      const int avg = makeRgba(r / 8, g / 8, b / 8, geta(test));
+      if (Gui::progressUpdate(y) < 0)
+        return;
+    }
 
-      if ((getl(avg) - getl(test)) > amount)
-        *p = avg;
+    Gui::progressHide();
+    return;
+  }
 
-      p++;
-    }
+  Bitmap src(w, h);
+  bmp->blit(&src, bmp->cl, bmp->ct, 0, 0, w, h);
+
+  const int batch = 256;
+
+  for (int y1 = 1; y1 < h - 1; y1 += batch)
+  {
+    const int y2 = std::min(y1 + batch - 1, h - 2);
+
+    Threads::run(y1, y2, [&](int, int first, int last)
+    {
+      // red, green and blue summed down each column of the 3x3 window
+      std::vector<int> sum(w * 3);
 
-    if (Gui::progressUpdate(y) < 0)
-      return;
+      for (int y = first; y <= last; y++)
+      {
+        const int *above = src.row[y - 1];
+        const int *s = src.row[y];
+        const int *below = src.row[y + 1];
+        int *p = bmp->row[y + bmp->ct] + bmp->cl;
+
+        for (int x = 0; x < w; x++)
+        {
+          const rgba_type c0 = getRgba(above[x]);
+          const rgba_type c1 = getRgba(s[x]);
+          const rgba_type c2 = getRgba(below[x]);
+
+          sum[x * 3 + 0] = c0.r + c1.r + c2.r;
+          sum[x * 3 + 1] = c0.g + c1.g + c2.g;
+          sum[x * 3 + 2] = c0.b + c1.b + c2.b;
+        }
+
+        for (int x = 1; x < w - 1; x++)
+        {
+          const int *k = &sum[x * 3];
+          const int test = s[x];
+          const rgba_type center = getRgba(test);
+          const int r = k[-3] + k[0] + k[3] - center.r;
+          const int g = k[-2] + k[1] + k[4] - center.g;
+          const int b = k[-1] + k[2] + k[5] - center.b;
+          const int avg = makeRgba(r / 8, g / 8, b / 8, geta(test));
+
+          if ((getl(avg) - getl(test)) > amount)
+            p[x] = avg;
+        }
+      }
+    });
+
+    for (int y = y1; y <= y2; y++)
+    {
+      if (Gui::progressUpdate(y + bmp->ct) < 0)
+        return;
+    }
   }
 
   Gui::progressHide();
@@ -84,13 +158,15 @@ void RemoveDust::apply(Bitmap *bmp, int amount)
 
 void RemoveDust::close()
 {
+  Preview::end();
   Items::dialog->hide();
   Project::undo->push();
 
   if (Items::invert->value())
     Invert::apply(Project::bmp);
 
-  apply(Project::bmp, atoi(Items::amount->value()));
+  apply(Project::bmp, atoi(Items::amount->value()),
+        Items::in_place->value());
 
   if (Items::invert->value())
     Invert::apply(Project::bmp);
@@ -98,12 +174,15 @@ void RemoveDust::close()
 
 void RemoveDust::quit()
 {
+  Preview::end();
   Gui::progressHide();
   Items::dialog->hide();
 }
 
 void RemoveDust::begin()
 {
+  Preview::begin(Items::preview);
+  preview();
   Items::dialog->show();
 }
 
@@ -116,13 +195,18 @@ void RemoveDust::init()
   Items::box->align(FL_ALIGN_INSIDE | FL_ALIGN_TOP);
 //    Items::box->labelsize(12);
   y1 += 32;
-  Items::amount = new InputInt(Items::dialog, 0, y1, 96, 24, "Amount (1-10)", 0, 1, 10);
+  Items::preview = new Widget(Items::dialog, 72, y1, 240, 240, 0, 1, 1, 0);
+  y1 += 240 + 8;
+  Items::amount = new InputInt(Items::dialog, 0, y1, 96, 24, "Amount (1-10)", (Fl_Callback *)preview, 1, 10);
   y1 += 24 + 8;
   Items::amount->value("4");
   Items::amount->center();
-  Items::invert = new CheckBox(Items::dialog, 0, y1, 16, 16, "Invert First", 0);
+  Items::invert = new CheckBox(Items::dialog, 0, y1, 16, 16, "Invert First", (Fl_Callback *)preview);
   y1 += 16 + 8;
   Items::invert->center();
+  Items::in_place = new CheckBox(Items::dialog, 0, y1, 16, 16, "Single Pass (Legacy)", (Fl_Callback *)preview);
+  y1 += 16 + 8;
+  Items::in_place->center();
   Items::dialog->addOkCancelButtons(&Items::ok, &Items::cancel, &y1);
   Items::ok->callback((Fl_Callback *)close);
   Items::cancel->callback((Fl_Callback *)quit);
@@ -130,3 +214,21 @@ void RemoveDust::init()
   Items::dialog->end();
 }
 
+void RemoveDust::preview()
+{
+  const int amount = atoi(Items::amount->value());
+  const bool invert = Items::invert->value();
+  const bool in_place = Items::in_place->value();
+
+  Preview::update([=](Bitmap *bmp, float)
+  {
+    if (invert)
+      Invert::apply(bmp);
+
+    apply(bmp, amount, in_place);
+
+    if (invert)
+      Invert::apply(bmp);
+  });
+}
+
@@ -30,6 +30,7 @@ namespace
   namespace Items
   {
     DialogWindow *dialog;
+    Widget *preview;
     Fl_Box *box;
     CheckBox *normalize;
     CheckBox *invert;
@@ -39,38 +40,16 @@ namespace
   }
 }
 
-void Restore::apply()
+void Restore::apply(Bitmap *bmp, bool keep_lum)
 {
-  Bitmap *bmp = Project::bmp;
-
-  double rr = 0;
-  double gg = 0;
-  double bb = 0;
-  int count = 0;
-
-  const bool keep_lum = Items::preserve_lum->value();
-
   // determine overall color cast
-  for (int y = bmp->ct; y <= bmp->cb; y++)
-  {
-    int *p = bmp->row[y] + bmp->cl;
+  ChannelHistogram hist;
 
-    for (int x = bmp->cl; x <= bmp->cr; x++)
-    {
-      const rgba_type rgba = getRgba(*p);
+  hist.build(bmp, false);
 
-      rr += rgba.r;
-      gg += rgba.g;
-      bb += rgba.b;
-
-      count++;
-      p++;
-    }
-  }
-
-  rr /= count;
-  gg /= count;
-  bb /= count;
+  const double rr = hist.mean(ChannelHistogram::RED);
+  const double gg = hist.mean(ChannelHistogram::GREEN);
+  const double bb = hist.mean(ChannelHistogram::BLUE);
 
   // adjustment factors
   const double ra = (256.0 / (256 - rr)) / std::sqrt(256.0 / (rr + 1));
@@ -78,46 +57,36 @@ void Restore::apply()
   const double ba = (256.0 / (256 - bb)) / std::sqrt(256.0 / (bb + 1));
 
   // begin restore
-  Gui::progressShow(bmp->h);
+  const double adjust[3] = { ra, ga, ba };
+  ColorLut lut;
 
-  for (int y = bmp->ct; y <= bmp->cb; y++)
+  if (keep_lum)
   {
-    int *p = bmp->row[y] + bmp->cl;
+    lut.compile([&](int r, int g, int b)
+    {
+      const int l = getlUnpacked(r, g, b);
+
+      r = clamp(255 * std::pow((double)r / 255, ra), 255);
+      g = clamp(255 * std::pow((double)g / 255, ga), 255);
+      b = clamp(255 * std::pow((double)b / 255, ba), 255);
 
-    for (int x = bmp->cl; x <= bmp->cr; x++)
+      return Blend::keepLum(makeRgb(r, g, b), l);
+    });
+  }
+    else
+  {
+    lut.compileChannels([&](int channel, int value)
     {
-      const rgba_type rgba = getRgba(*p);
-      int r = rgba.r;
-      int g = rgba.g;
-      int b = rgba.b;
-      const int l = getl(*p);
-
-      // apply adjustments
-      r = 255 * std::pow((double)r / 255, ra);
-      g = 255 * std::pow((double)g / 255, ga);
-      b = 255 * std::pow((double)b / 255, ba);
-
-      r = clamp(r, 255);
-      g = clamp(g, 255);
-      b = clamp(b, 255);
-
-      if (keep_lum)
-        *p = Blend::keepLum(makeRgba(r, g, b, rgba.a), l);
-      else
-        *p = makeRgba(r, g, b, rgba.a);
-
-      p++;
-    }
-
-    if (Gui::progressUpdate(y) < 0)
-      return;
+      return (int)(255 * std::pow((double)value / 255, adjust[channel]));
+    });
   }
 
-  Gui::progressHide();
+  lut.apply(bmp, true);
 }
 
 void Restore::close()
 {
+  Preview::end();
   Items::dialog->hide();
   Project::undo->push();
 
@@ -126,7 +95,7 @@ void Restore::close()
   if (Items::invert->value())
     Invert::apply(Project::bmp);
 
-  apply();
+  apply(Project::bmp, Items::preserve_lum->value());
 
   if (Items::invert->value())
     Invert::apply(Project::bmp);
@@ -134,12 +103,15 @@ void Restore::close()
 
 void Restore::quit()
 {
+  Preview::end();
   Gui::progressHide();
   Items::dialog->hide();
 }
 
 void Restore::begin()
 {
+  Preview::begin(Items::preview);
+  preview();
   Items::dialog->show();
 }
 
@@ -152,14 +124,16 @@ void Restore::init()
   Items::box->align(FL_ALIGN_INSIDE | FL_ALIGN_TOP);
 //    Items::box->labelsize(12);
   y1 += 32;
-  Items::normalize = new CheckBox(Items::dialog, 0, y1, 16, 16, "Normalize First", 0);
+  Items::preview = new Widget(Items::dialog, 72, y1, 240, 240, 0, 1, 1, 0);
+  y1 += 240 + 8;
+  Items::normalize = new CheckBox(Items::dialog, 0, y1, 16, 16, "Normalize First", (Fl_Callback *)preview);
   y1 += 16 + 8;
   Items::normalize->value(0);
   Items::normalize->center();
-  Items::invert = new CheckBox(Items::dialog, 0, y1, 16, 16, "Invert First", 0);
+  Items::invert = new CheckBox(Items::dialog, 0, y1, 16, 16, "Invert First", (Fl_Callback *)preview);
   Items::invert->center();
   y1 += 16 + 8;
-  Items::preserve_lum = new CheckBox(Items::dialog, 8, y1, 16, 16, "Preserve Luminosity", 0);
+  Items::preserve_lum = new CheckBox(Items::dialog, 8, y1, 16, 16, "Preserve Luminosity", (Fl_Callback *)preview);
   y1 += 16 + 8;
   Items::preserve_lum->center();
   Items::dialog->addOkCancelButtons(&Items::ok, &Items::cancel, &y1);
@@ -169,3 +143,23 @@ void Restore::init()
   Items::dialog->end();
 }
 
+void Restore::preview()
+{
+  const bool normalize = Items::normalize->value();
+  const bool invert = Items::invert->value();
+  const bool keep_lum = Items::preserve_lum->value();
+
+  Preview::update([=](Bitmap *bmp, float)
+  {
+    if (normalize)
+      Normalize::apply(bmp);
+    if (invert)
+      Invert::apply(bmp);
+
+    apply(bmp, keep_lum);
+
+    if (invert)
+      Invert::apply(bmp);
+  });
+}
+
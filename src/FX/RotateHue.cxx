@@ -33,75 +33,62 @@ namespace
     Fl_Button *ok;
     Fl_Button *cancel;
   }
+
+  // compiled hue rotation and the settings it was made with
+  ColorLut lut;
+  int lut_hue = -1;
+  bool lut_keep_lum = false;
 }
 
-void RotateHue::apply(Bitmap *dest, bool show_progress)
+void RotateHue::apply(Bitmap *dest, int hue, bool keep_lum,
+                      bool show_progress)
 {
-  const int hh = (((Items::hue->var + 180) % 360) * 6) * .712;
-  const bool keep_lum = Items::preserve_lum->value();
-
-  FX::drawPreview(Project::bmp, Items::preview->bitmap);
-
-  if (show_progress)
-    Gui::progressShow(dest->h);
+  const int hh = (((hue + 180) % 360) * 6) * .712;
 
-  for (int y = dest->ct; y <= dest->cb; y++)
+  // the preview and the final result usually share the same settings
+  if (hh != lut_hue || keep_lum != lut_keep_lum)
   {
-    int *p = dest->row[y] + dest->cl;
-
-    for (int x = dest->cl; x <= dest->cr; x++)
+    lut.compile([&](int r, int g, int b)
     {
-      int c = *p;
-
-      rgba_type rgba = getRgba(c);
-
-      const int l = getl(c);
-      int r = rgba.r;
-      int g = rgba.g;
-      int b = rgba.b;
+      const int l = getlUnpacked(r, g, b);
       int h, s, v;
 
       Blend::rgbToHsv(r, g, b, &h, &s, &v);
       h += hh;
       h %= 1536;
-
       Blend::hsvToRgb(h, s, v, &r, &g, &b);
-      c = makeRgba(r, g, b, rgba.a);
 
-      if (keep_lum)
-        *p = Blend::keepLum(c, l);
-      else
-        *p = c;
+      const int c = makeRgb(r, g, b);
 
-      p++;
-    }
+      return keep_lum ? Blend::keepLum(c, l) : c;
+    });
 
-    if (show_progress)
-      if (Gui::progressUpdate(y) < 0)
-        return;
+    lut_hue = hh;
+    lut_keep_lum = keep_lum;
   }
 
-  Gui::progressHide();
+  lut.apply(dest, show_progress);
 }
 
 void RotateHue::begin()
 {
   Items::hue->var = 180;
-  FX::drawPreview(Project::bmp, Items::preview->bitmap);
-  Items::preview->redraw();
+  Preview::begin(Items::preview);
   Items::hue->do_callback();
   Items::dialog->show();
 }
 
 void RotateHue::close()
 {
+  Preview::end();
   Items::dialog->hide();
   Project::undo->push();
-  apply(Project::bmp, true);
+  apply(Project::bmp, Items::hue->var, Items::preserve_lum->value(), true);
 }
 
 void RotateHue::quit()
 {
+  Preview::end();
   Gui::progressHide();
   Items::dialog->hide();
 }
@@ -157,8 +144,14 @@ void RotateHue::setHue()
   snprintf(degree, sizeof(degree), "%d\xB0", (int)(hx - 180));
 
   Items::hue->copy_label(degree);
-  apply(Items::preview->bitmap, false);
-  Items::preview->redraw();
+
+  const int hue = Items::hue->var;
+  const bool keep_lum = Items::preserve_lum->value();
+
+  Preview::update([=](Bitmap *bmp, float)
+  {
+    apply(bmp, hue, keep_lum, false);
+  });
 }
 
 void RotateHue::incHue()
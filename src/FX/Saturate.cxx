@@ -20,81 +20,49 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
 
 #include "Saturate.H"
 
-void Saturate::apply(Bitmap *bmp)
+// Builds the table for an image whose colors are first passed through
+// input, so this can follow other color changes in a Chain.
+void Saturate::compile(ColorLut *lut, Bitmap *bmp, const ColorLut &input)
 {
-  std::vector<int> list_s(256, 0);
-
-  const int size = bmp->cw * bmp->ch;
-
-  for (int y = bmp->ct; y <= bmp->cb; y++)
-  {
-    int *p = bmp->row[y] + bmp->cl;
-    for (int x = bmp->cl; x <= bmp->cr; x++)
-    {
-      rgba_type rgba = getRgba(*p);
-
-      const int r = rgba.r;
-      const int g = rgba.g;
-      const int b = rgba.b;
-
-      int h, s, v;
-      Blend::rgbToHsv(r, g, b, &h, &s, &v);
-
-      list_s[s]++;
-      p++;
-    }
-  }
+  ChannelHistogram hist;
 
-  for (int j = 255; j >= 0; j--)
-    for (int i = 0; i < j; i++)
-      list_s[j] += list_s[i];
+  hist.build(bmp, true, input);
 
-  const double scale = 255.0 / size;
+  const std::vector<int> list_s =
+    hist.cumulative(ChannelHistogram::SATURATION);
+  const double scale = 255.0 / hist.total;
 
-  Gui::progressShow(bmp->h);
-
-  for (int y = bmp->ct; y <= bmp->cb; y++)
+  lut->compile([&](int r, int g, int b)
   {
-    int *p = bmp->row[y] + bmp->cl;
-
-    for (int x = bmp->cl; x <= bmp->cr; x++)
-    {
-      rgba_type rgba = getRgba(*p);
-
-      int r = rgba.r;
-      int g = rgba.g;
-      int b = rgba.b;
-
-      const int l = getl(*p);
-      int h, s, v;
+    const int c1 = makeRgb(r, g, b);
+    const int l = getl(c1);
+    int h, s, v;
 
-      Blend::rgbToHsv(r, g, b, &h, &s, &v);
+    Blend::rgbToHsv(r, g, b, &h, &s, &v);
 
-      // don't try to saturate grays
-      if (s == 0)
-      {
-        p++;
-        continue;
-      }
+    // don't try to saturate grays
+    if (s == 0)
+      return c1;
 
-      const int temp = s;
-      s = list_s[s] * scale;
+    const int temp = s;
+    s = list_s[s] * scale;
 
-      if (s < temp)
-        s = temp;
+    if (s < temp)
+      s = temp;
 
-      Blend::hsvToRgb(h, s, v, &r, &g, &b);
+    Blend::hsvToRgb(h, s, v, &r, &g, &b);
 
-      const int c1 = *p;
-      *p = Blend::colorize(c1, Blend::keepLum(makeRgba(r, g, b, rgba.a), l), 255 - s);
-      p++;
-    }
+    return Blend::colorize(c1, Blend::keepLum(makeRgb(r, g, b), l), 255 - s);
+  });
+}
 
-    if (Gui::progressUpdate(y) < 0)
-      return;
-  }
+void Saturate::apply(Bitmap *bmp)
+{
+  ColorLut identity;
+  ColorLut lut;
 
-  Gui::progressHide();
+  compile(&lut, bmp, identity);
+  lut.apply(bmp, true);
 }
 
 void Saturate::begin()
@@ -18,6 +18,9 @@ along with Rendera; if not, write to the Free Software
 Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
 */
 
+#include <algorithm>
+#include <vector>
+
 #include "Sharpen.H"
 
 namespace
@@ -25,6 +28,7 @@ namespace
   namespace Items
   {
     DialogWindow *dialog;
+    Widget *preview;
     InputInt *amount;
     Fl_Button *ok;
     Fl_Button *cancel;
@@ -33,46 +37,85 @@ namespace
 
 void Sharpen::apply(Bitmap *bmp, int amount)
 {
-  Bitmap temp(bmp->cw, bmp->ch);
+  // reads from a copy so rows can be written in place
+  Bitmap src(bmp->cw, bmp->ch);
+  bmp->blit(&src, bmp->cl, bmp->ct, 0, 0, bmp->cw, bmp->ch);
+
+  const int w = bmp->cw;
+  const int trans = 255 - amount * 2.55;
+  const int batch = 256;
 
   Gui::progressShow(bmp->h);
 
-  for (int y = bmp->ct; y <= bmp->cb; y++)
+  for (int y1 = bmp->ct; y1 <= bmp->cb; y1 += batch)
   {
-    int *p = temp.row[y - bmp->cl];
+    const int y2 = std::min(y1 + batch - 1, bmp->cb);
 
-    for (int x = bmp->cl; x <= bmp->cr; x++)
+    Threads::run(y1 - bmp->ct, y2 - bmp->ct, [&](int, int first, int last)
     {
-      int lum = 0;
+      // luminance of the rows above, at and below the current one, one
+      // pixel wider on each side, with the edges repeated
+      std::vector<int> lum((w + 2) * 3);
+
+      auto lumRow = [&](const int y)
+      {
+        return &lum[(((y % 3) + 3) % 3) * (w + 2)];
+      };
+
+      auto fill = [&](const int y)
+      {
+        const int *s = src.row[std::min(std::max(y, 0), src.h - 1)];
+        int *l = lumRow(y);
 
-      for (int j = 0; j < 3; j++) 
+        for (int x = 0; x < w; x++)
+          l[x + 1] = getl(s[x]);
+
+        l[0] = l[1];
+        l[w + 1] = l[w];
+      };
+
+      fill(first - 1);
+      fill(first);
+
+      for (int y = first; y <= last; y++)
       {
-        for (int i = 0; i < 3; i++) 
+        fill(y + 1);
+
+        const int *l[3] = { lumRow(y - 1), lumRow(y), lumRow(y + 1) };
+        const int *s = src.row[y];
+        int *p = bmp->row[y + bmp->ct] + bmp->cl;
+
+        for (int x = 0; x < w; x++)
         {
-          lum += getl(bmp->getpixel(x + i - 1, y + j - 1))
-                   * FilterMatrix::sharpen[i][j];
+          int sum = 0;
+
+          for (int j = 0; j < 3; j++)
+          {
+            for (int i = 0; i < 3; i++)
+              sum += l[j][x + i] * FilterMatrix::sharpen[i][j];
+          }
+
+          const int c = s[x];
+
+          sum = clamp(sum, 255);
+          p[x] = Blend::trans(c, Blend::keepLum(c, sum), trans);
         }
       }
+    });
 
-      const int c = bmp->getpixel(x, y);
-
-      lum = clamp(lum, 255);
-      *p = Blend::trans(c, Blend::keepLum(c, lum), 255 - amount * 2.55);
-      p++;
+    for (int y = y1; y <= y2; y++)
+    {
+      if (Gui::progressUpdate(y) < 0)
+        return;
     }
-
-    if (Gui::progressUpdate(y) < 0)
-      return;
   }
 
-  temp.blit(bmp, 0, 0, bmp->cl, bmp->ct, temp.w, temp.h);
-
   Gui::progressHide();
-
 }
 
 void Sharpen::close()
 {
+  Preview::end();
   Items::dialog->hide();
   Project::undo->push();
 
@@ -81,12 +124,15 @@ void Sharpen::close()
 
 void Sharpen::quit()
 {
+  Preview::end();
   Gui::progressHide();
   Items::dialog->hide();
 }
 
 void Sharpen::begin()
 {
+  Preview::begin(Items::preview);
+  preview();
   Items::dialog->show();
 }
  
@@ -95,7 +141,9 @@ void Sharpen::init()
   int y1 = 8;
 
   Items::dialog = new DialogWindow(256, 0, "Sharpen");
-  Items::amount = new InputInt(Items::dialog, 0, y1, 96, 24, "Amount %", 0, 0, 100);
+  Items::preview = new Widget(Items::dialog, 8, y1, 240, 240, 0, 1, 1, 0);
+  y1 += 240 + 8;
+  Items::amount = new InputInt(Items::dialog, 0, y1, 96, 24, "Amount %", (Fl_Callback *)preview, 0, 100);
   y1 += 24 + 8;
   Items::amount->value("10");
   Items::amount->center();
@@ -106,3 +154,13 @@ void Sharpen::init()
   Items::dialog->end();
 }
 
+void Sharpen::preview()
+{
+  const int amount = atoi(Items::amount->value());
+
+  Preview::update([=](Bitmap *bmp, float)
+  {
+    apply(bmp, amount);
+  });
+}
+
@@ -25,6 +25,7 @@ namespace
   namespace Items
   {
     DialogWindow *dialog;
+    Widget *preview;
     InputInt *amount;
     Fl_Button *ok;
     Fl_Button *cancel;
@@ -33,70 +34,59 @@ namespace
 
 void Sobel::apply(Bitmap *bmp, int amount)
 {
-//  Bitmap *bmp = Project::bmp;
-//  int amount = atoi(Items::amount->value());
-  int div = 1;
+  // the convolution reads from a copy so rows can be written in place
+  Bitmap src(bmp->cw, bmp->ch);
+  bmp->blit(&src, bmp->cl, bmp->ct, 0, 0, bmp->cw, bmp->ch);
+
+  const int trans = 255 - amount * 2.55;
+  const int batch = 256;
 
-  Bitmap temp(bmp->cw, bmp->ch);
   Gui::progressShow(bmp->h);
 
-  for (int y = bmp->ct; y <= bmp->cb; y++)
+  for (int y1 = bmp->ct; y1 <= bmp->cb; y1 += batch)
   {
-    int *p = temp.row[y - bmp->cl];
+    const int y2 = std::min(y1 + batch - 1, bmp->cb);
 
-    for (int x = bmp->cl; x <= bmp->cr; x++)
+    Threads::run(y1, y2, [&](int, int first, int last)
     {
-      int r1 = 0;
-      int g1 = 0;
-      int b1 = 0;
-      int r2 = 0;
-      int g2 = 0;
-      int b2 = 0;
-
-      for (int j = 0; j < 3; j++) 
+      Convolution conv1(&src, &FilterMatrix::sobel1[0][0], 3);
+      Convolution conv2(&src, &FilterMatrix::sobel2[0][0], 3);
+
+      for (int y = first; y <= last; y++)
       {
-        for (int i = 0; i < 3; i++) 
+        const int *s1 = conv1.row(y - bmp->ct);
+        const int *s2 = conv2.row(y - bmp->ct);
+        int *p = bmp->row[y] + bmp->cl;
+
+        for (int x = 0; x < bmp->cw; x++)
         {
-          const rgba_type rgba = getRgba(bmp->getpixel(x + i - 1, y + j - 1));
-
-          r1 += rgba.r * FilterMatrix::sobel1[i][j];
-          r2 += rgba.r * FilterMatrix::sobel2[i][j];
-          g1 += rgba.g * FilterMatrix::sobel1[i][j];
-          g2 += rgba.g * FilterMatrix::sobel2[i][j];
-          b1 += rgba.b * FilterMatrix::sobel1[i][j];
-          b2 += rgba.b * FilterMatrix::sobel2[i][j];
+          const int r = std::sqrt(s1[0] * s1[0] + s2[0] * s2[0]);
+          const int g = std::sqrt(s1[1] * s1[1] + s2[1] * s2[1]);
+          const int b = std::sqrt(s1[2] * s1[2] + s2[2] * s2[2]);
+          const int c = *p;
+
+          *p++ = Blend::trans(c, makeRgba(clamp(r, 255),
+                                          clamp(g, 255),
+                                          clamp(b, 255), geta(c)), trans);
+          s1 += 4;
+          s2 += 4;
         }
       }
+    });
 
-      int r = std::sqrt(r1 * r1 + r2 * r2);
-      int g = std::sqrt(g1 * g1 + g2 * g2);
-      int b = std::sqrt(b1 * b1 + b2 * b2);
-
-      r /= div;
-      g /= div;
-      b /= div;
-
-      r = clamp(r, 255);
-      g = clamp(g, 255);
-      b = clamp(b, 255);
-
-      const int c = bmp->getpixel(x, y);
-
-      *p = Blend::trans(c, makeRgba(r, g, b, geta(c)), 255 - amount * 2.55);
-      p++;
+    for (int y = y1; y <= y2; y++)
+    {
+      if (Gui::progressUpdate(y) < 0)
+        return;
     }
-
-    if (Gui::progressUpdate(y) < 0)
-      return;
   }
 
-  temp.blit(bmp, 0, 0, bmp->cl, bmp->ct, temp.w, temp.h);
-
   Gui::progressHide();
 }
 
 void Sobel::close()
 {
+  Preview::end();
   Items::dialog->hide();
   Project::undo->push();
 //  apply();
@@ -107,12 +97,15 @@ void Sobel::close()
 
 void Sobel::quit()
 {
+  Preview::end();
   Gui::progressHide();
   Items::dialog->hide();
 }
 
 void Sobel::begin()
 {
+  Preview::begin(Items::preview);
+  preview();
   Items::dialog->show();
 }
 
@@ -121,7 +114,9 @@ void Sobel::init()
   int y1 = 8;
 
   Items::dialog = new DialogWindow(256, 0, "Sobel Edge Detection");
-  Items::amount = new InputInt(Items::dialog, 0, y1, 96, 24, "Amount %", 0, 0, 100);
+  Items::preview = new Widget(Items::dialog, 8, y1, 240, 240, 0, 1, 1, 0);
+  y1 += 240 + 8;
+  Items::amount = new InputInt(Items::dialog, 0, y1, 96, 24, "Amount %", (Fl_Callback *)preview, 0, 100);
   Items::amount->value("100");
   Items::amount->center();
   y1 += 24 + 8;
@@ -132,3 +127,13 @@ void Sobel::init()
   Items::dialog->end();
 }
 
+void Sobel::preview()
+{
+  const int amount = atoi(Items::amount->value());
+
+  Preview::update([=](Bitmap *bmp, float)
+  {
+    apply(bmp, amount);
+  });
+}
+
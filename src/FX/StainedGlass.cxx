@@ -18,6 +18,12 @@ along with Rendera; if not, write to the Free Software
 Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
 */
 
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <stdint.h>
+#include <vector>
+
 #include "StainedGlass.H"
 
 namespace
@@ -25,6 +31,7 @@ namespace
   namespace Items
   {
     DialogWindow *dialog;
+    Widget *preview;
     InputInt *detail;
     InputInt *edge;
     CheckBox *uniform;
@@ -59,149 +66,268 @@ namespace
     else
       return 1;
   }
-}
 
-void StainedGlass::apply()
-{
-  Bitmap *bmp = Project::bmp;
-  int size = atoi(Items::detail->value());
-  int div = atoi(Items::edge->value());
+  // seeds bucketed into a grid of square cells, in index order per cell
+  struct grid_type
+  {
+    int cell;
+    int w, h;
+    std::vector<int> start;
+    std::vector<int> index;
+  };
+
+  void makeGrid(grid_type *grid, const std::vector<int> &seedx,
+                const std::vector<int> &seedy, const int w, const int h)
+  {
+    const int size = seedx.size();
 
-  std::vector<int> seedx(size);
-  std::vector<int> seedy(size);
-  std::vector<int> color(size);
+    // about two seeds per cell
+    grid->cell = std::max(1, (int)std::sqrt(2.0 * w * h / size));
+    grid->w = (w + grid->cell - 1) / grid->cell;
+    grid->h = (h + grid->cell - 1) / grid->cell;
+    grid->start.assign(grid->w * grid->h + 1, 0);
+    grid->index.resize(size);
 
-  for (int i = 0; i < size; i++)
-  {
-    if (Items::uniform->value())
+    for (int i = 0; i < size; i++)
     {
-      seedx[i] = rnd() % bmp->w; 
-      seedy[i] = rnd() % bmp->h; 
+      const int c = (seedy[i] / grid->cell) * grid->w + seedx[i] / grid->cell;
+
+      grid->start[c + 1]++;
     }
-      else
-    {
-      seedx[i] = rnd() % bmp->w; 
-      seedy[i] = rnd() % bmp->h; 
 
-      int count = 0;
+    for (int i = 0; i < grid->w * grid->h; i++)
+      grid->start[i + 1] += grid->start[i];
 
-      do
-      {
-        seedx[i] = rnd() % bmp->w; 
-        seedy[i] = rnd() % bmp->h; 
-        count++;
-      }
-      while (!isEdge(bmp, seedx[i], seedy[i], div) && count < 10000);
-    }
+    std::vector<int> fill(grid->start.begin(), grid->start.end() - 1);
 
-    color[i] = bmp->getpixel(seedx[i], seedy[i]);
-  }
+    for (int i = 0; i < size; i++)
+    {
+      const int c = (seedy[i] / grid->cell) * grid->w + seedx[i] / grid->cell;
 
-  Gui::progressShow(bmp->h);
+      grid->index[fill[c]++] = i;
+    }
+  }
 
-  // draw segments
-  for (int y = bmp->ct; y <= bmp->cb; y++)
+  // Searches rings of cells outward from the one containing x, y until
+  // no unvisited cell can hold a closer seed. Ties go to the lowest
+  // index, the same as a search over every seed.
+  int nearestSeed(const grid_type &grid, const std::vector<int> &seedx,
+                  const std::vector<int> &seedy, const int x, const int y)
   {
-    int *p = bmp->row[y] + bmp->cl;
+    const int cx = x / grid.cell;
+    const int cy = y / grid.cell;
+    int nearest = INT_MAX;
+    int use = -1;
 
-    for (int x = bmp->cl; x <= bmp->cr; x++)
+    auto visit = [&](const int i, const int j)
     {
-      // find nearest color
-      int nearest = 999999999;
-      int use = -1;
+      const int c = j * grid.w + i;
 
-      for (int i = 0; i < size; i++)
+      for (int k = grid.start[c]; k < grid.start[c + 1]; k++)
       {
-        const int dx = x - seedx[i];
-        const int dy = y - seedy[i];
+        const int s = grid.index[k];
+        const int dx = x - seedx[s];
+        const int dy = y - seedy[s];
         const int distance = dx * dx + dy * dy;
 
-        if (distance < nearest)
+        if (distance < nearest || (distance == nearest && s < use))
         {
           nearest = distance;
-          use = i;
+          use = s;
         }
       }
+    };
 
-      if (use != -1)
+    for (int r = 0; ; r++)
+    {
+      const int x1 = cx - r;
+      const int x2 = cx + r;
+      const int y1 = cy - r;
+      const int y2 = cy + r;
+
+      for (int j = std::max(y1, 0); j <= std::min(y2, grid.h - 1); j++)
       {
-        if (Items::sat_alpha->value())
+        if (j == y1 || j == y2)
         {
-          rgba_type rgba = getRgba(color[use]);
-
-          int h, s, v;
-
-          Blend::rgbToHsv(rgba.r, rgba.g, rgba.b, &h, &s, &v);
-          *p = makeRgba(rgba.r, rgba.g, rgba.b, std::min(192, s / 2 + 128));
+          for (int i = std::max(x1, 0); i <= std::min(x2, grid.w - 1); i++)
+            visit(i, j);
         }
           else
         {
-          *p = color[use];
+          if (x1 >= 0)
+            visit(x1, j);
+          if (x2 < grid.w)
+            visit(x2, j);
         }
       }
 
-      p++;
+      if (x1 <= 0 && y1 <= 0 && x2 >= grid.w - 1 && y2 >= grid.h - 1)
+        break;
+
+      // closest any cell outside this ring can be
+      const int m = std::min(std::min(x - x1 * grid.cell + 1,
+                                      (x2 + 1) * grid.cell - x),
+                             std::min(y - y1 * grid.cell + 1,
+                                      (y2 + 1) * grid.cell - y));
+
+      if (use != -1 && nearest < m * m)
+        break;
     }
 
-    if (Gui::progressUpdate(y) < 0)
-      return;
+    return use;
   }
+}
 
-  // draw edges
-  if (Items::draw_edges->value())
+void StainedGlass::apply(Bitmap *bmp, int size, int div, bool uniform,
+                         bool sat_alpha, bool draw_edges)
+{
+  std::vector<int> seedx(size);
+  std::vector<int> seedy(size);
+  std::vector<int> color(size);
+
+  // edge pixels to place seeds on
+  std::vector<int> edges;
+
+  if (!uniform)
   {
-    Map *map = Project::map;
-    map->clear(0);
-//      for (int y = bmp->ct * 4; y <= bmp->cb * 4; y++)
-//      {
-//        for (int x = bmp->cl * 4; x <= bmp->cr * 4; x++)
-//        {
-    for (int y = bmp->ct; y <= bmp->cb; y++)
+    std::vector<std::vector<int> > found(Threads::count());
+
+    Threads::run(bmp->ct, bmp->cb, [&](int band, int first, int last)
     {
-      for (int x = bmp->cl; x <= bmp->cr; x++)
+      for (int y = first; y <= last; y++)
       {
-        if (isSegmentEdge(bmp, x, y))
-          map->setpixel(x, y, 1);
-//            map->setpixelAA(x, y, 255);
+        for (int x = bmp->cl; x <= bmp->cr; x++)
+        {
+          if (isEdge(bmp, x, y, div))
+            found[band].push_back(y * bmp->w + x);
+        }
       }
+    });
+
+    for (size_t i = 0; i < found.size(); i++)
+      edges.insert(edges.end(), found[i].begin(), found[i].end());
+  }
+
+  for (int i = 0; i < size; i++)
+  {
+    if (edges.size() > 0)
+    {
+      const int pos = edges[(rnd() & 0x7FFFFFFF) % edges.size()];
+
+      seedx[i] = pos % bmp->w;
+      seedy[i] = pos / bmp->w;
+    }
+      else
+    {
+      seedx[i] = (rnd() & 0x7FFFFFFF) % bmp->w;
+      seedy[i] = (rnd() & 0x7FFFFFFF) % bmp->h;
     }
 
-    for (int y = bmp->ct; y <= bmp->cb; y++)
+    color[i] = bmp->getpixel(seedx[i], seedy[i]);
+
+    if (sat_alpha)
     {
-      int *p = bmp->row[y] + bmp->cl;
+      const rgba_type rgba = getRgba(color[i]);
+      int h, s, v;
 
-      for (int x = bmp->cl; x <= bmp->cr; x++)
-      {
-        const int c = map->getpixel(x, y);
+      Blend::rgbToHsv(rgba.r, rgba.g, rgba.b, &h, &s, &v);
+      color[i] = makeRgba(rgba.r, rgba.g, rgba.b, std::min(192, s / 2 + 128));
+    }
+  }
+
+  grid_type grid;
 
-//          *p = Blend::trans(*p, makeRgb(0, 0, 0), 255 - c);
-        if (c)
-          *p = makeRgb(0, 0, 0);
-//        *p = Blend::trans(*p, makeRgb(0, 0, 0), 160);
+  makeGrid(&grid, seedx, seedy, bmp->w, bmp->h);
 
-        p++;
+  const int batch = 256;
+
+  Gui::progressShow(bmp->h);
+
+  // draw segments
+  for (int y1 = bmp->ct; y1 <= bmp->cb; y1 += batch)
+  {
+    const int y2 = std::min(y1 + batch - 1, bmp->cb);
+
+    Threads::run(y1, y2, [&](int, int first, int last)
+    {
+      for (int y = first; y <= last; y++)
+      {
+        int *p = bmp->row[y] + bmp->cl;
+
+        for (int x = bmp->cl; x <= bmp->cr; x++)
+          *p++ = color[nearestSeed(grid, seedx, seedy, x, y)];
       }
+    });
+
+    for (int y = y1; y <= y2; y++)
+    {
+      if (Gui::progressUpdate(y) < 0)
+        return;
     }
   }
 
+  // draw edges
+  if (draw_edges)
+  {
+    std::vector<uint8_t> mask(bmp->cw * bmp->ch);
+
+    Threads::run(bmp->ct, bmp->cb, [&](int, int first, int last)
+    {
+      for (int y = first; y <= last; y++)
+      {
+        uint8_t *m = &mask[(y - bmp->ct) * bmp->cw];
+
+        for (int x = bmp->cl; x <= bmp->cr; x++)
+          *m++ = isSegmentEdge(bmp, x, y);
+      }
+    });
+
+    Threads::run(bmp->ct, bmp->cb, [&](int, int first, int last)
+    {
+      for (int y = first; y <= last; y++)
+      {
+        const uint8_t *m = &mask[(y - bmp->ct) * bmp->cw];
+        int *p = bmp->row[y] + bmp->cl;
+
+        for (int x = bmp->cl; x <= bmp->cr; x++)
+        {
+          if (*m++)
+            *p = makeRgb(0, 0, 0);
+
+          p++;
+        }
+      }
+    });
+  }
+
   Gui::progressHide();
 }
 
 void StainedGlass::close()
 {
-    Items::dialog->hide();
-    Project::undo->push();
-    apply();
+  Preview::end();
+  Items::dialog->hide();
+  Project::undo->push();
+
+  apply(Project::bmp,
+        atoi(Items::detail->value()),
+        atoi(Items::edge->value()),
+        Items::uniform->value(),
+        Items::sat_alpha->value(),
+        Items::draw_edges->value());
 }
 
 void StainedGlass::quit()
 {
+  Preview::end();
   Gui::progressHide();
   Items::dialog->hide();
 }
 
 void StainedGlass::begin()
 {
+  Preview::begin(Items::preview);
+  preview();
   Items::dialog->show();
 }
 
@@ -210,21 +336,23 @@ void StainedGlass::init()
   int y1 = 8;
 
   Items::dialog = new DialogWindow(256, 0, "Stained Glass");
-  Items::detail = new InputInt(Items::dialog, 0, y1, 96, 24, "Detail (1-50000)", 0, 1, 50000);
+  Items::preview = new Widget(Items::dialog, 8, y1, 240, 240, 0, 1, 1, 0);
+  y1 += 240 + 8;
+  Items::detail = new InputInt(Items::dialog, 0, y1, 96, 24, "Detail (1-50000)", (Fl_Callback *)preview, 1, 50000);
   y1 += 24 + 8;
   Items::detail->value("5000");
   Items::detail->center();
-  Items::edge = new InputInt(Items::dialog, 0, y1, 96, 24, "Edge Detect (1-50)", 0, 1, 50);
+  Items::edge = new InputInt(Items::dialog, 0, y1, 96, 24, "Edge Detect (1-50)", (Fl_Callback *)preview, 1, 50);
   y1 += 24 + 8;
   Items::edge->value("16");
   Items::edge->center();
-  Items::uniform = new CheckBox(Items::dialog, 0, y1, 16, 16, "Uniform", 0);
+  Items::uniform = new CheckBox(Items::dialog, 0, y1, 16, 16, "Uniform", (Fl_Callback *)preview);
   Items::uniform->center();
   y1 += 16 + 8;
-  Items::sat_alpha = new CheckBox(Items::dialog, 0, y1, 16, 16, "Saturation to Alpha", 0);
+  Items::sat_alpha = new CheckBox(Items::dialog, 0, y1, 16, 16, "Saturation to Alpha", (Fl_Callback *)preview);
   Items::sat_alpha->center();
   y1 += 16 + 8;
-  Items::draw_edges = new CheckBox(Items::dialog, 0, y1, 16, 16, "Draw Edges", 0);
+  Items::draw_edges = new CheckBox(Items::dialog, 0, y1, 16, 16, "Draw Edges", (Fl_Callback *)preview);
   Items::draw_edges->center();
   y1 += 16 + 8;
   Items::dialog->addOkCancelButtons(&Items::ok, &Items::cancel, &y1);
@@ -234,3 +362,19 @@ void StainedGlass::init()
   Items::dialog->end();
 }
 
+void StainedGlass::preview()
+{
+  const int detail = atoi(Items::detail->value());
+  const int edge = atoi(Items::edge->value());
+  const bool uniform = Items::uniform->value();
+  const bool sat_alpha = Items::sat_alpha->value();
+  const bool draw_edges = Items::draw_edges->value();
+
+  // detail is a seed count, so keep the cell size the same
+  Preview::update([=](Bitmap *bmp, float scale)
+  {
+    apply(bmp, std::max(1, (int)(detail * scale * scale + .5f)), edge,
+          uniform, sat_alpha, draw_edges);
+  });
+}
+
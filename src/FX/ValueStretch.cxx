@@ -22,103 +22,38 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
 
 void ValueStretch::apply(Bitmap *bmp)
 {
-  std::vector<int> list_r(256, 0);
-  std::vector<int> list_g(256, 0);
-  std::vector<int> list_b(256, 0);
+  ChannelHistogram hist;
 
-  double rr = 0;
-  double gg = 0;
-  double bb = 0;
-  int count = 0;
+  hist.build(bmp, false);
 
-  // determine overall color cast
-  for (int y = bmp->ct; y <= bmp->cb; y++)
+  // overall color cast
+  const double cast[3] =
   {
-    for (int x = bmp->cl; x <= bmp->cr; x++)
-    {
-      rgba_type rgba = getRgba(bmp->getpixel(x, y));
+    hist.mean(ChannelHistogram::RED),
+    hist.mean(ChannelHistogram::GREEN),
+    hist.mean(ChannelHistogram::BLUE)
+  };
 
-      rr += rgba.r;
-      gg += rgba.g;
-      bb += rgba.b;
-
-      count++;
-    }
-  }
-
-  rr /= count;
-  gg /= count;
-  bb /= count;
-
-  const int size = bmp->cw * bmp->ch;
-
-  for (int y = bmp->ct; y <= bmp->cb; y++)
-  {
-    int *p = bmp->row[y] + bmp->cl;
-
-    for (int x = bmp->cl; x <= bmp->cr; x++)
-    {
-      rgba_type rgba = getRgba(*p);
-
-      const int r = rgba.r;
-      const int g = rgba.g;
-      const int b = rgba.b;
-
-      list_r[r]++;
-      list_g[g]++;
-      list_b[b]++;
-
-      p++;
-    }
-  }
-
-  for (int j = 255; j >= 0; j--)
+  const std::vector<int> list[3] =
   {
-    for (int i = 0; i < j; i++)
-    {
-      list_r[j] += list_r[i];
-      list_g[j] += list_g[i];
-      list_b[j] += list_b[i];
-    }
-  }
+    hist.cumulative(ChannelHistogram::RED),
+    hist.cumulative(ChannelHistogram::GREEN),
+    hist.cumulative(ChannelHistogram::BLUE)
+  };
 
-  double scale = 255.0 / size;
+  const double scale = 255.0 / hist.total;
 
-  Gui::progressShow(bmp->h);
+  ColorLut lut;
 
-  for (int y = bmp->ct; y <= bmp->cb; y++)
+  lut.compileChannels([&](int channel, int value)
   {
-    int *p = bmp->row[y] + bmp->cl;
-
-    for (int x = bmp->cl; x <= bmp->cr; x++)
-    {
-      rgba_type rgba = getRgba(*p);
-
-      int r = rgba.r;
-      int g = rgba.g;
-      int b = rgba.b;
-
-      const int ra = list_r[r] * scale;
-      const int ga = list_g[g] * scale;
-      const int ba = list_b[b] * scale;
-
-      r = ((ra * rr) + (r * (255 - rr))) / 255;
-      g = ((ga * gg) + (g * (255 - gg))) / 255;
-      b = ((ba * bb) + (b * (255 - bb))) / 255;
-
-      r = clamp(r, 255);
-      g = clamp(g, 255);
-      b = clamp(b, 255);
-
-      *p = makeRgba(r, g, b, rgba.a);
-      p++;
-    }
+    const int stretched = list[channel][value] * scale;
 
-    if (Gui::progressUpdate(y) < 0)
-      return;
-  }
+    return (int)(((stretched * cast[channel]) +
+                  (value * (255 - cast[channel]))) / 255);
+  });
 
-  Gui::progressHide();
+  lut.apply(bmp, true);
 }
 
 void ValueStretch::begin()
@@ -28,24 +28,21 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
 #include "Gui.H"
 #include "Inline.H"
 #include "KDtree.H"
-#include "Map.H"
 #include "Project.H"
 #include "Stroke.H"
+#include "Threads.H"
 #include "Undo.H"
 #include "View.H"
 
 Fill::Fill()
 {
-  stack_size = 4096;
-  stack_x = new int [stack_size];
-  stack_y = new int [stack_size];
-  sp = 0;
+  mask_w = 0;
+  mask_h = 0;
+  mask_stride = 0;
 }
 
 Fill::~Fill()
 {
-  delete[] stack_x;
-  delete[] stack_y;
 }
 
 bool Fill::inbox(int x, int y, int x1, int y1, int x2, int y2)
@@ -62,21 +59,21 @@ bool Fill::inbox(int x, int y, int x1, int y1, int x2, int y2)
 }
 
 // finds edges
-bool Fill::isEdge(Map *map, const int x, const int y)
+bool Fill::isEdge(const int x, const int y)
 {
   // special case
-  if (x < 1 || x > map->w - 2 || y < 1 || y > map->h - 2)
+  if (x < 1 || x > mask_w - 2 || y < 1 || y > mask_h - 2)
   {
-    if (*(map->row[y] + x))
+    if (maskGet(x, y))
       return 0;
     else
       return 1;
   }
 
-  if ( *(map->row[y - 1] + x) &&
-      *(map->row[y] + x - 1) &&
-      *(map->row[y] + x + 1) &&
-      *(map->row[y + 1] + x) )
+  if (maskGet(x, y - 1) &&
+      maskGet(x - 1, y) &&
+      maskGet(x + 1, y) &&
+      maskGet(x, y + 1))
   {
     return 0;
   }
@@ -105,123 +102,209 @@ int Fill::fineEdge(int x1, int y1, const int x2, const int y2,
 // flood-fill related stack routines
 bool Fill::pop(int *x, int *y)
 {
-  if (sp > 0)
-  {
-    *x = stack_x[sp];
-    *y = stack_y[sp];
-    sp--;
-    return true;
-  }
+  if (stack.empty())
+    return false;
 
-  return false;
+  *x = stack.back().x;
+  *y = stack.back().y;
+  stack.pop_back();
+
+  return true;
 }
 
-bool Fill::push(const int x, const int y)
+void Fill::push(const int x, const int y)
 {
-  if (sp < stack_size - 1)
-  {
-    sp++;
-    stack_x[sp] = x;
-    stack_y[sp] = y;
-    return true;
-  }
-
-  return false;
+  stack.push_back({ x, y });
 }
 
 void Fill::clear()
 {
-  int x, y;
+  stack.clear();
+}
 
-  while (pop(&x, &y))
-  {
-    // loop until pop returns false
-  }
+// visited pixel mask routines, coordinates are relative to the clip area
+void Fill::maskInit(const int w, const int h)
+{
+  mask_w = w;
+  mask_h = h;
+  mask_stride = (w + 31) / 32;
+  mask.assign(mask_stride * h, 0);
 }
 
-bool Fill::inRange(const int c1, const int c2, const int range)
+bool Fill::maskGet(const int x, const int y)
 {
-  if ((std::sqrt(diff32(c1, c2)) / 2) <= range)
-    return true;
-  else
-    return false;
+  return (mask[y * mask_stride + (x >> 5)] >> (x & 31)) & 1;
 }
 
+// set bits x1 through x2 of row y
+void Fill::maskSet(const int x1, const int x2, const int y)
+{
+  uint32_t *row = &mask[y * mask_stride];
+
+  for (int x = x1; x <= x2; x++)
+    row[x >> 5] |= 1u << (x & 31);
+}
+
+// compares squared distance with a squared threshold
+bool Fill::inRange(const int c1, const int c2, const int threshold)
+{
+  return diff32(c1, c2) <= threshold;
+}
+
+// Scanline flood fill. Pixels are recolored in place and tracked in a
+// 1-bit visited mask, so the image doesn't need to be copied and filled
+// pixels are never tested twice. Each popped seed is extended to a full
+// span, then one seed is pushed for every run of matching pixels above
+// and below it.
 void Fill::fill(int x, int y, int new_color, int old_color, int range, int feather)
 {
   if (old_color == new_color)
     return;
 
   clear();
-  
-  if (!push(x, y))
-    return;
 
   Bitmap *bmp = Project::bmp;
-  Bitmap temp(bmp->w, bmp->h);
-  bmp->blit(&temp, 0, 0, 0, 0, bmp->w, bmp->h);
-  Map *map = Project::map;
-  map->clear(0);
 
   int cl = bmp->cl;
   int cr = bmp->cr;
   int ct = bmp->ct;
   int cb = bmp->cb;
 
+  // same as sqrt(diff32(c1, c2)) / 2 <= range
+  const int threshold = 4 * range * range;
+
+  maskInit(bmp->cw, bmp->ch);
+  push(x, y);
+
+  // pixel still needs filling
+  auto fillable = [&](const int xx, const int yy)
+  {
+    return !maskGet(xx - cl, yy - ct) &&
+           inRange(*(bmp->row[yy] + xx), old_color, threshold);
+  };
+
   while (pop(&x, &y))
-  {    
+  {
+    if (!fillable(x, y))
+      continue;
+
     int x1 = x;
+    int x2 = x;
 
-    while (x1 >= cl && inRange(temp.getpixel(x1, y), old_color, range))
+    while (x1 > cl && fillable(x1 - 1, y))
       x1--;
 
-    x1++;
+    while (x2 < cr && fillable(x2 + 1, y))
+      x2++;
+
+    maskSet(x1 - cl, x2 - cl, y - ct);
+
+    int *p = bmp->row[y] + x1;
 
-    bool span_t = false;
-    bool span_b = false;
+    for (int i = x1; i <= x2; i++)
+      *p++ = new_color;
 
-    while (x1 <= cr && inRange(temp.getpixel(x1, y), old_color, range))
+    // seed runs in neighboring rows
+    for (int yy = y - 1; yy <= y + 1; yy += 2)
     {
-      temp.setpixel(x1, y, new_color);
-      map->setpixel(x1 - bmp->cl, y - bmp->ct, 255);
+      if (yy < ct || yy > cb)
+        continue;
 
-      if ((!span_t && y > ct) && inRange(temp.getpixel(x1, y - 1),
-                                        old_color, range))
-      {
-        if (!push(x1, y - 1))
-          return;
+      bool span = false;
 
-        span_t = true;
-      }
-      else if ((span_t && y > ct) && !inRange(temp.getpixel(x1, y - 1),
-                                             old_color, range))
+      for (int i = x1; i <= x2; i++)
       {
-        span_t = false;
+        if (fillable(i, yy))
+        {
+          if (!span)
+          {
+            push(i, yy);
+            span = true;
+          }
+        }
+          else
+        {
+          span = false;
+        }
       }
+    }
+  }
 
-      if ((!span_b && y < cb) && inRange(temp.getpixel(x1, y + 1),
-                                        old_color, range))
+  if (feather > 0)
+    featherEdges(new_color, feather);
+}
+
+// Non-contiguous fill, recolors every pixel in range of old_color.
+// Rows are independent, so bands are processed in parallel.
+void Fill::replace(int new_color, int old_color, int range, int feather)
+{
+  if (old_color == new_color)
+    return;
+
+  Bitmap *bmp = Project::bmp;
+
+  const int cl = bmp->cl;
+  const int ct = bmp->ct;
+  const int cb = bmp->cb;
+  const int threshold = 4 * range * range;
+  const int batch = 256;
+
+  maskInit(bmp->cw, bmp->ch);
+  Gui::progressShow((cb - ct) + 1);
+
+  for (int y1 = ct; y1 <= cb; y1 += batch)
+  {
+    const int y2 = std::min(y1 + batch - 1, cb);
+
+    Threads::run(y1, y2, [&](int, int first, int last)
+    {
+      std::vector<uint8_t> match(bmp->cw);
+
+      for (int y = first; y <= last; y++)
       {
-        if (!push(x1, y + 1))
-          return;
+        int *p = bmp->row[y] + cl;
+
+        // kept branch-free so the distance test can be vectorized
+        for (int x = 0; x < bmp->cw; x++)
+        {
+          const int c = p[x];
+          const int m = diff32(c, old_color) <= threshold;
 
-        span_b = true;
+          match[x] = m;
+          p[x] = m ? new_color : c;
+        }
+
+        // mask rows don't share words, so bands can write them safely
+        uint32_t *row = &mask[(y - ct) * mask_stride];
+
+        for (int x = 0; x < bmp->cw; x++)
+          row[x >> 5] |= (uint32_t)match[x] << (x & 31);
       }
-      else if ((span_b && y < cb) && !inRange(temp.getpixel(x1, y + 1),
-                                             old_color, range))
-      {
-        span_b = false;
-      } 
+    });
 
-      x1++;
+    for (int y = y1; y <= y2; y++)
+    {
+      if (Gui::progressUpdate(y) < 0)
+        return;
     }
   }
 
-  if (feather == 0)
-  {
-    temp.blit(bmp, 0, 0, 0, 0, temp.w, temp.h);
-    return;
-  }
+  Gui::progressHide();
+
+  if (feather > 0)
+    featherEdges(new_color, feather);
+}
+
+// blends new_color outward from the edges of the filled area in the mask
+void Fill::featherEdges(int new_color, int feather)
+{
+  Bitmap *bmp = Project::bmp;
+
+  int cl = bmp->cl;
+  int cr = bmp->cr;
+  int ct = bmp->ct;
+  int cb = bmp->cb;
+  int x, y;
 
   Stroke *stroke = Project::stroke;
   int count = 0;
@@ -232,14 +315,12 @@ void Fill::fill(int x, int y, int new_color, int old_color, int range, int feath
   {
     for (x = cl; x <= cr; x++)
     {
-      if (map->getpixel(x - cl, y - ct) && isEdge(map, x - cl, y - ct))
+      if (count <= 0xfffff && maskGet(x - cl, y - ct) &&
+          isEdge(x - cl, y - ct))
       {
         stroke->edge_x[count] = x;
         stroke->edge_y[count] = y;
         count++;
-
-        if (count > 0xfffff)
-          break;
       }
     }
 
@@ -308,21 +389,11 @@ void Fill::fill(int x, int y, int new_color, int old_color, int range, int feath
   root = KDtree::build(points, count, 0, 2);
   Gui::progressShow((cb - ct) + 1);
 
-  for (y = ct; y <= cb; y++)
-  {
-    for (x = cl; x <= cr; x++)
-    {
-      if (x > tl || x < tr || y < tt || y > tb)
-        if (map->getpixel(x - cl, y - ct) == 255)
-          bmp->setpixel(x, y, new_color);
-    }
-  }
-
   for (y = tt; y <= tb; y++)
   {
     for (x = tl; x <= tr; x++)
     {
-      if (map->getpixel(x - cl, y - ct) == 255)
+      if (maskGet(x - cl, y - ct))
         continue;
 
       test_node.x[0] = x;
@@ -358,8 +429,15 @@ void Fill::push(View *view)
     int color = makeRgba(rgba.r, rgba.g, rgba.b, 255 - Project::brush->trans);
     int target = Project::bmp->getpixel(view->imgx, view->imgy);
 
-    fill(view->imgx, view->imgy, color, target,
-         Gui::getFillRange(), Gui::getFillFeather());
+    if (Gui::getFillReplace())
+    {
+      replace(color, target, Gui::getFillRange(), Gui::getFillFeather());
+    }
+      else
+    {
+      fill(view->imgx, view->imgy, color, target,
+           Gui::getFillRange(), Gui::getFillFeather());
+    }
 
     view->drawMain(true);
   }
@@ -48,6 +48,15 @@ const int FilterMatrix::gaussian[3][3] =
   {  1,  2,  1 }
 };
 
+const int FilterMatrix::gaussian5[5][5] =
+{
+  {  1,  4,  6,  4,  1 },
+  {  4, 16, 24, 16,  4 },
+  {  6, 24, 36, 24,  6 },
+  {  4, 16, 24, 16,  4 },
+  {  1,  4,  6,  4,  1 }
+};
+
 const int FilterMatrix::edge[3][3] =
 {
   { -1, -1, -1 },
@@ -19,6 +19,8 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
 */
 
 #include <cmath>
+#include <stdint.h>
+#include <vector>
 
 #include <FL/fl_draw.H>
 #include <FL/Fl_Group.H>
@@ -26,10 +28,78 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
 #include "Fractal.H"
 #include "Inline.H"
 #include "Map.H"
+#include "Threads.H"
 
 namespace
 {
-  int level, turb;
+  inline uint32_t mix(uint32_t h)
+  {
+    h ^= h >> 16;
+    h *= 0x7feb352d;
+    h ^= h >> 15;
+    h *= 0x846ca68b;
+    h ^= h >> 16;
+
+    return h;
+  }
+
+  // Random offset for a new point. It's a hash of the point's place in
+  // the subdivision rather than its pixel position, so maps of different
+  // sizes made with the same seed share their large features.
+  inline int offset(const uint32_t seed, const int level, const int kind,
+                    const int i, const int j, const int turb)
+  {
+    const uint32_t n = mix(mix(mix(mix(seed + level) + kind) + i) + j);
+    const int r = ((n >> 1) % turb) >> level;
+
+    return (n & 1) ? -r : r;
+  }
+
+  inline int displace(const int a, const int b, const int r)
+  {
+    const int v = ((a + b + 1) >> 1) + r;
+
+    return v < 1 ? 1 : (v > 255 ? 255 : v);
+  }
+
+  // midpoint of each interval wide enough to split, -1 for the rest
+  bool midpoints(const std::vector<int> &ends, std::vector<int> *mid)
+  {
+    bool found = false;
+
+    mid->resize(ends.size() - 1);
+
+    for (size_t i = 0; i < mid->size(); i++)
+    {
+      if (ends[i + 1] - ends[i] >= 2)
+      {
+        (*mid)[i] = (ends[i] + ends[i + 1]) >> 1;
+        found = true;
+      }
+        else
+      {
+        (*mid)[i] = -1;
+      }
+    }
+
+    return found;
+  }
+
+  void insert(std::vector<int> *ends, const std::vector<int> &mid)
+  {
+    std::vector<int> merged;
+
+    for (size_t i = 0; i < mid.size(); i++)
+    {
+      merged.push_back((*ends)[i]);
+
+      if (mid[i] >= 0)
+        merged.push_back(mid[i]);
+    }
+
+    merged.push_back(ends->back());
+    ends->swap(merged);
+  }
 }
 
 void Fractal::marble(Map *src, Map *dest, Map *marbx, Map *marby, float scale, float turbulence, int type)
@@ -37,8 +107,7 @@ void Fractal::marble(Map *src, Map *dest, Map *marbx, Map *marby, float scale, f
   int xval[256];
   int yval[256];
 
-  int x, y, i;
-  int xx, yy;
+  int i;
   int w = src->w;
   int h = src->h;
   float xv, yv;
@@ -99,27 +168,40 @@ void Fractal::marble(Map *src, Map *dest, Map *marbx, Map *marby, float scale, f
         yval[i] = yv;
         break;
     }
+
+    // offsets wrap around the map
+    xval[i] %= w;
+    yval[i] %= h;
   }
 
-  for (y = 0; y < h; y++)
+  // each row only reads the source, so bands of rows run in parallel
+  Threads::run(0, h - 1, [&](int, int first, int last)
   {
-    for (x = 0; x < w; x++)
+    for (int y = first; y <= last; y++)
     {
-      xx = x + xval[marbx->getpixel(x, y)];
-      yy = y + yval[marby->getpixel(x, y)];
-
-      while (xx < 0)
-        xx += w;
-      while (yy < 0)
-        yy += h;
-      while (xx >= w)
-        xx -= w;
-      while (yy >= h)
-        yy -= h;
-
-      dest->setpixel(x, y, src->getpixel(xx, yy));
+      const unsigned char *mx = marbx->row[y];
+      const unsigned char *my = marby->row[y];
+      unsigned char *d = dest->row[y];
+
+      for (int x = 0; x < w; x++)
+      {
+        int xx = x + xval[mx[x]];
+        int yy = y + yval[my[x]];
+
+        if (xx < 0)
+          xx += w;
+        else if (xx >= w)
+          xx -= w;
+
+        if (yy < 0)
+          yy += h;
+        else if (yy >= h)
+          yy -= h;
+
+        d[x] = src->row[yy][xx];
+      }
     }
-  }
+  });
 }
 
 /*
@@ -128,8 +210,7 @@ void Fractal::wood(Map *src, Map *dest, Map *marbx, Map *marby, float scale, int
   int xval[256];
   int yval[256];
 
-  int x, y, i;
-  int xx, yy;
+  int i;
   int w = src->w;
   int h = src->h;
 
@@ -214,99 +295,112 @@ void Fractal::wood(Map *src, Map *dest, Map *marbx, Map *marby, float scale, int
 }
 */
 
-void Fractal::plasma(Map * map, int turbulence)
+// Midpoint displacement, one level at a time. The map is a grid of
+// rectangles made by splitting the columns and rows at their midpoints.
+// At each level the new points along the edges are offset from the
+// average of their ends, then each center is the average of its four
+// edge points. Every point of a step depends only on earlier steps, so
+// the rows are split among threads. Opposite edges match, so the result
+// tiles.
+void Fractal::plasma(Map *map, int turbulence, int seed)
 {
-  int w, h;
+  const int w = map->w;
+  const int h = map->h;
 
   map->clear(0);
-  turb = turbulence;
-  level = 0;
 
-  w = map->w;
-  h = map->h;
+  std::vector<int> xs;
+  std::vector<int> ys;
+  std::vector<int> xm;
+  std::vector<int> ym;
 
-  map->setpixel(0, 0, 0);
-  map->setpixel(w - 1, 0, 0);
-  map->setpixel(0, h - 1, 0);
-  map->setpixel(w - 1, h - 1, 0);
+  xs.push_back(0);
+  xs.push_back(w - 1);
+  ys.push_back(0);
+  ys.push_back(h - 1);
 
-  divide(map, 0, 0, w - 1, h - 1);
-}
-
-int Fractal::adjust(Map * map, int xa, int ya, int x, int y, int xb, int yb)
-{
-  int r = (rnd() % turb) >> level;
-
-  if ((rnd() % 2) == 0)
-    r = -r;
-
-  r = ((map->getpixel(xa, ya) + map->getpixel(xb, yb) + 1) >> 1) + r;
-
-  if (r < 1)
-    r = 1;
-  if (r > 255)
-    r = 255;
-
-  map->setpixel(x, y, r);
-
-  if (x == 0)
-    map->setpixel(map->w - 1, y, r);
-  if (y == 0)
-    map->setpixel(x, map->h - 1, r);
-  if (x == map->w - 1)
-    map->setpixel(0, y, r);
-  if (y == map->h - 1)
-    map->setpixel(x, 0, r);
-
-  return r;
-}
-
-void Fractal::divide(Map * map, int x1, int y1, int x2, int y2)
-{
-  int x, y, i, v;
-
-  if (((x2 - x1) < 2) && ((y2 - y1) < 2))
-    return;
-
-  level++;
-
-  x = (x1 + x2) >> 1;
-  y = (y1 + y2) >> 1;
-
-  v = map->getpixel(x, y1);
-
-  if (!v)
-    v = Fractal::adjust(map, x1, y1, x, y1, x2, y1);
-
-  i = v;
-  v = map->getpixel(x2, y);
-
-  if (!v)
-    v = Fractal::adjust(map, x2, y1, x2, y, x2, y2);
-
-  i += v;
-  v = map->getpixel(x, y2);
-
-  if (!v)
-    v = Fractal::adjust(map, x1, y2, x, y2, x2, y2);
-
-  i += v;
-  v = map->getpixel(x1, y);
-
-  if (!v)
-    v = Fractal::adjust(map, x1, y1, x1, y, x1, y2);
-
-  i += v;
+  for (int level = 1; ; level++)
+  {
+    const bool split_x = midpoints(xs, &xm);
+    const bool split_y = midpoints(ys, &ym);
 
-  if (!map->getpixel(x, y))
-    map->setpixel(x, y, ((i + 2) >> 2));
+    if (!split_x && !split_y)
+      break;
 
-  divide(map, x1, y1, x, y);
-  divide(map, x, y1, x2, y);
-  divide(map, x, y, x2, y2);
-  divide(map, x1, y, x, y2);
+    // along the rows, the bottom row is a copy of the top
+    if (split_x)
+    {
+      Threads::run(0, ys.size() - 1, [&](int, int first, int last)
+      {
+        for (int j = first; j <= last; j++)
+        {
+          if (j > 0 && ys[j] == h - 1)
+            continue;
+
+          unsigned char *p = map->row[ys[j]];
+
+          for (size_t i = 0; i < xm.size(); i++)
+          {
+            if (xm[i] >= 0)
+            {
+              p[xm[i]] = displace(p[xs[i]], p[xs[i + 1]],
+                                  offset(seed, level, 0, i, j, turbulence));
+            }
+          }
+        }
+      });
+
+      if (h > 1)
+      {
+        for (size_t i = 0; i < xm.size(); i++)
+        {
+          if (xm[i] >= 0)
+            map->row[h - 1][xm[i]] = map->row[0][xm[i]];
+        }
+      }
+    }
 
-  level--;
+    // down the columns, then the centers, the right column is a copy of
+    // the left
+    if (split_y)
+    {
+      Threads::run(0, ym.size() - 1, [&](int, int first, int last)
+      {
+        for (int j = first; j <= last; j++)
+        {
+          if (ym[j] < 0)
+            continue;
+
+          const unsigned char *top = map->row[ys[j]];
+          const unsigned char *bottom = map->row[ys[j + 1]];
+          unsigned char *p = map->row[ym[j]];
+
+          for (size_t i = 0; i < xs.size(); i++)
+          {
+            if (i > 0 && xs[i] == w - 1)
+              continue;
+
+            p[xs[i]] = displace(top[xs[i]], bottom[xs[i]],
+                                offset(seed, level, 1, i, j, turbulence));
+          }
+
+          if (w > 1)
+            p[w - 1] = p[0];
+
+          for (size_t i = 0; i < xm.size(); i++)
+          {
+            if (xm[i] >= 0)
+            {
+              p[xm[i]] = (top[xm[i]] + bottom[xm[i]] +
+                          p[xs[i]] + p[xs[i + 1]] + 2) >> 2;
+            }
+          }
+        }
+      });
+    }
 
+    insert(&xs, xm);
+    insert(&ys, ym);
+  }
 }
 
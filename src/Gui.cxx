@@ -137,6 +137,7 @@ namespace
 
   InputInt *fill_range;
   InputInt *fill_feather;
+  CheckBox *fill_replace;
   Fl_Button *fill_reset;
 
   StaticText *selection_x;
@@ -149,6 +150,7 @@ namespace
   Button *selection_flip;
   Button *selection_mirror;
   Button *selection_rotate;
+  Fl_Button *selection_transform;
   Fl_Button *selection_paste;
   Fl_Button *selection_crop;
 
@@ -389,6 +391,8 @@ void Gui::init()
     (Fl_Callback *)Transform::rotate180, 0, 0);
   menubar->add("&Image/Rotate/Arbitrary...", 0,
     (Fl_Callback *)Transform::rotateArbitrary, 0, 0);
+  menubar->add("&Image/&Transform...", 0,
+    (Fl_Callback *)Transform::transform, 0, 0);
 
   menubar->add("&Selection/&Open...", 0,
     (Fl_Callback *)File::loadSelection, 0, 0);
@@ -483,6 +487,9 @@ void Gui::init()
   menubar->add("F&X/Artistic/Marble...", 0,
     (Fl_Callback *)Marble::begin, 0, 0);
 
+  menubar->add("F&X/Presets/Enhance and Dither", 0,
+    (Fl_Callback *)Chain::begin, 0, 0);
+
   menubar->add("&Help/&About...", 0,
     (Fl_Callback *)Dialog::about, 0, 0);
 
@@ -764,6 +771,10 @@ void Gui::init()
   selection_rotate = new Button(selection, 8 + 66, pos, 30, 30, "Rotate", images_select_rotate_png, (Fl_Callback *)selectRotate90);
   pos += 30 + 8;
 
+  selection_transform = new Fl_Button(selection->x() + 8, selection->y() + pos, 96, 32, "Transform...");
+  selection_transform->callback((Fl_Callback *)selectTransform);
+  pos += 32 + 8;
+
   new Separator(selection, 4, pos, 106, 2, "");
   pos += 8;
 
@@ -895,6 +906,12 @@ void Gui::init()
   fill_feather->value("0");
   pos += 24 + 24;
 
+  fill_replace = new CheckBox(fill, 8, pos, 16, 16, "Replace All", 0);
+  fill_replace->tooltip("Replace similar colors everywhere");
+  fill_replace->labelsize(13);
+  fill_replace->center();
+  pos += 16 + 8;
+
   new Separator(fill, 4, pos, 106, 2, "");
   pos += 8;
 
@@ -1402,11 +1419,13 @@ void Gui::paintTextureEdge(Widget *, void *var)
 void Gui::paintTextureMarb(Widget *, void *var)
 {
   Project::brush->texture_marb = *(int *)var;
+  Render::prepareTexture();
 }
 
 void Gui::paintTextureTurb(Widget *, void *var)
 {
   Project::brush->texture_turb = *(int *)var;
+  Render::prepareTexture();
 }
 
 void Gui::paintAverageEdge(Widget *, void *var)
@@ -1719,26 +1738,11 @@ void Gui::selectFlipY()
 
 void Gui::selectRotate90()
 {
-  int w = Project::select_bmp->w;
-  int h = Project::select_bmp->h;
+  Bitmap *temp = new Bitmap(Project::select_bmp->h, Project::select_bmp->w);
 
-  // make copy
-  Bitmap temp(w, h);
-  Project::select_bmp->blit(&temp, 0, 0, 0, 0, w, h);
-
-  // create rotated image
+  Project::select_bmp->rotate90(temp);
   delete Project::select_bmp;
-  Project::select_bmp = new Bitmap(h, w);
-
-  int *p = &temp.data[0];
-
-  for (int y = 0; y < h; y++)
-  {
-    for (int x = 0; x < w; x++)
-    {
-       *(Project::select_bmp->row[x] + h - 1 - y) = *p++;
-    }
-  }
+  Project::select_bmp = temp;
 
   Project::selection->reload();
 }
@@ -1748,6 +1752,11 @@ void Gui::selectRotate180()
   Project::select_bmp->rotate180();
 }
 
+void Gui::selectTransform()
+{
+  Transform::transformSelection();
+}
+
 void Gui::selectReset()
 {
   Project::tool->reset();
@@ -2194,10 +2203,16 @@ int Gui::getFillFeather()
   return atoi(fill_feather->value());
 }
 
+int Gui::getFillReplace()
+{
+  return fill_replace->value();
+}
+
 void Gui::fillReset()
 {
   fill_range->value("0");
   fill_feather->value("0");
+  fill_replace->value(0);
 }
 
 void Gui::imagesDuplicate()
@@ -2259,8 +2274,9 @@ void Gui::progressShow(float step, int interval)
 
 int Gui::progressUpdate(int y)
 {
+  // a filter running on a preview stops here when it's out of date
   if (progress_enable == false)
-    return 0;
+    return Preview::cancelled() ? -1 : 0;
 
   // user cancelled operation
   if (Fl::get_key(FL_Escape))
@@ -0,0 +1,156 @@
+/*
+Copyright (c) 2024 Joe Davisson.
+
+This file is part of Rendera.
+
+Rendera is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+Rendera is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Rendera; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+*/
+
+#include <vector>
+
+#include "Bitmap.H"
+#include "Histogram.H"
+#include "Threads.H"
+
+namespace
+{
+  // pixels sorted at once per thread, limits memory use on large images
+  const int chunk_size = 1 << 20;
+
+  // sort 24-bit colors with three 8-bit radix passes
+  void radixSort(std::vector<int> &keys, std::vector<int> &temp)
+  {
+    const int size = keys.size();
+
+    temp.resize(size);
+
+    for (int shift = 0; shift < 24; shift += 8)
+    {
+      int offset[257] = { 0 };
+
+      for (int i = 0; i < size; i++)
+        offset[((keys[i] >> shift) & 255) + 1]++;
+
+      for (int i = 0; i < 256; i++)
+        offset[i + 1] += offset[i];
+
+      for (int i = 0; i < size; i++)
+        temp[offset[(keys[i] >> shift) & 255]++] = keys[i];
+
+      keys.swap(temp);
+    }
+  }
+
+  // convert sorted colors into bins with run counts
+  void countRuns(const std::vector<int> &keys,
+                 std::vector<Histogram::bin_type> &bins)
+  {
+    const int size = keys.size();
+
+    bins.clear();
+
+    for (int i = 0; i < size; )
+    {
+      const int color = keys[i];
+      int j = i + 1;
+
+      while (j < size && keys[j] == color)
+        j++;
+
+      bins.push_back({ color, j - i });
+      i = j;
+    }
+  }
+
+  // merge sorted bins into dest, adding the counts of matching colors
+  void mergeBins(std::vector<Histogram::bin_type> &dest,
+                 const std::vector<Histogram::bin_type> &src)
+  {
+    std::vector<Histogram::bin_type> result;
+    result.reserve(dest.size() + src.size());
+
+    int i = 0;
+    int j = 0;
+
+    while (i < (int)dest.size() && j < (int)src.size())
+    {
+      if (dest[i].color < src[j].color)
+      {
+        result.push_back(dest[i++]);
+      }
+        else if (dest[i].color > src[j].color)
+      {
+        result.push_back(src[j++]);
+      }
+        else
+      {
+        result.push_back({ dest[i].color, dest[i].count + src[j].count });
+        i++;
+        j++;
+      }
+    }
+
+    while (i < (int)dest.size())
+      result.push_back(dest[i++]);
+
+    while (j < (int)src.size())
+      result.push_back(src[j++]);
+
+    dest.swap(result);
+  }
+}
+
+// Builds a sparse color histogram of the clipping area. Each thread
+// radix-sorts its pixels in chunks and counts runs, then the sorted
+// lists are merged. Only occupied colors are stored.
+Histogram::Histogram(Bitmap *bmp)
+{
+  std::vector<std::vector<bin_type> > band_bins(Threads::count());
+
+  Threads::run(bmp->ct, bmp->cb, [&](int band, int y1, int y2)
+  {
+    std::vector<int> keys;
+    std::vector<int> temp;
+    std::vector<bin_type> runs;
+
+    keys.reserve(chunk_size + bmp->cw);
+
+    for (int y = y1; y <= y2; y++)
+    {
+      const int *p = bmp->row[y] + bmp->cl;
+
+      for (int x = bmp->cl; x <= bmp->cr; x++)
+        keys.push_back(*p++ & 0xffffff);
+
+      if ((int)keys.size() >= chunk_size || y == y2)
+      {
+        radixSort(keys, temp);
+        countRuns(keys, runs);
+        mergeBins(band_bins[band], runs);
+        keys.clear();
+      }
+    }
+  });
+
+  for (int i = 0; i < (int)band_bins.size(); i++)
+    mergeBins(bins, band_bins[i]);
+
+  total = bmp->cw * bmp->ch;
+}
+
+Histogram::~Histogram()
+{
+}
+
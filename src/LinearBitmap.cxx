@@ -0,0 +1,196 @@
+/*
+Copyright (c) 2024 Joe Davisson.
+
+This file is part of Rendera.
+
+Rendera is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+Rendera is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Rendera; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+*/
+
+#include <algorithm>
+#include <vector>
+
+#include "Bitmap.H"
+#include "Gamma.H"
+#include "Inline.H"
+#include "LinearBitmap.H"
+#include "Threads.H"
+
+LinearBitmap::LinearBitmap(int width, int height)
+{
+  if (width < 1)
+    width = 1;
+  if (height < 1)
+    height = 1;
+
+  w = width;
+  h = height;
+
+  for (int i = 0; i < 4; i++)
+    plane[i].resize(w * h);
+}
+
+LinearBitmap::~LinearBitmap()
+{
+}
+
+// converts the area starting at x, y of a bitmap
+void LinearBitmap::fromBitmap(Bitmap *bmp, const int x, const int y)
+{
+  Threads::run(0, h - 1, [&](int, int first, int last)
+  {
+    for (int j = first; j <= last; j++)
+    {
+      const int *p = bmp->row[y + j] + x;
+      const int offset = j * w;
+
+      for (int i = 0; i < w; i++)
+      {
+        const rgba_type rgba = getRgba(*p++);
+
+        plane[0][offset + i] = Gamma::fix(rgba.r);
+        plane[1][offset + i] = Gamma::fix(rgba.g);
+        plane[2][offset + i] = Gamma::fix(rgba.b);
+        plane[3][offset + i] = rgba.a * 257;
+      }
+    }
+  });
+}
+
+// returns a pixel converted back to a normal color
+int LinearBitmap::getpixel(const int x, const int y)
+{
+  const int offset = x + y * w;
+
+  return makeRgba(Gamma::unfix(plane[0][offset]),
+                  Gamma::unfix(plane[1][offset]),
+                  Gamma::unfix(plane[2][offset]),
+                  (plane[3][offset] + 128) / 257);
+}
+
+// Box blur along rows using a running sum. The window covers lo pixels
+// to the left and size - lo - 1 to the right, so even sizes can be
+// centered by alternating lo between passes. Edges repeat the border
+// pixel and are handled outside the main loop.
+void LinearBitmap::boxBlurX(const int size, const int lo)
+{
+  const int hi = size - lo - 1;
+  const int last = w - 1;
+  const int half = size / 2;
+
+  Threads::run(0, h - 1, [&](int, int first, int last_row)
+  {
+    std::vector<uint16_t> temp(w);
+
+    for (int c = 0; c < 4; c++)
+    {
+      for (int y = first; y <= last_row; y++)
+      {
+        uint16_t *dest = &plane[c][y * w];
+        const uint16_t *src = &temp[0];
+
+        std::copy(dest, dest + w, temp.begin());
+
+        auto at = [&](const int i)
+        {
+          return src[i < 0 ? 0 : (i > last ? last : i)];
+        };
+
+        int sum = 0;
+
+        for (int i = -lo; i <= hi; i++)
+          sum += at(i);
+
+        const int left_end = std::min(lo, w);
+        const int mid_end = last - hi - 1;
+        int x = 0;
+
+        for (; x < left_end; x++)
+        {
+          dest[x] = (sum + half) / size;
+          sum += at(x + hi + 1) - at(x - lo);
+        }
+
+        for (; x <= mid_end; x++)
+        {
+          dest[x] = (sum + half) / size;
+          sum += src[x + hi + 1] - src[x - lo];
+        }
+
+        for (; x < w; x++)
+        {
+          dest[x] = (sum + half) / size;
+          sum += at(x + hi + 1) - at(x - lo);
+        }
+      }
+    }
+  });
+}
+
+// Box blur along columns. Whole rows are swept top to bottom keeping a
+// running sum per column, so memory is always read in row order. The
+// rows leaving the window have already been overwritten, so their
+// original values are kept in a small ring buffer.
+void LinearBitmap::boxBlurY(const int size, const int lo)
+{
+  const int hi = size - lo - 1;
+  const int last = h - 1;
+  const int half = size / 2;
+  const int ring_size = lo + 1;
+
+  Threads::run(0, w - 1, [&](int, int x1, int x2)
+  {
+    const int bw = x2 - x1 + 1;
+    std::vector<int> sum(bw);
+    std::vector<uint16_t> ring(ring_size * bw);
+
+    for (int c = 0; c < 4; c++)
+    {
+      uint16_t *p = &plane[c][x1];
+
+      std::fill(sum.begin(), sum.end(), 0);
+
+      for (int i = -lo; i <= hi; i++)
+      {
+        const uint16_t *src = p + clamp(i, last) * w;
+
+        for (int x = 0; x < bw; x++)
+          sum[x] += src[x];
+      }
+
+      for (int y = 0; y <= last; y++)
+      {
+        uint16_t *dest = p + y * w;
+        uint16_t *saved = &ring[(y % ring_size) * bw];
+
+        for (int x = 0; x < bw; x++)
+        {
+          saved[x] = dest[x];
+          dest[x] = (sum[x] + half) / size;
+        }
+
+        if (y == last)
+          break;
+
+        const int leave = y - lo;
+        const uint16_t *add = p + std::min(y + hi + 1, last) * w;
+        const uint16_t *sub = &ring[((leave < 0 ? 0 : leave) % ring_size) * bw];
+
+        for (int x = 0; x < bw; x++)
+          sum[x] += add[x] - sub[x];
+      }
+    }
+  });
+}
+
@@ -18,18 +18,20 @@ along with Rendera; if not, write to the Free Software
 Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
 */
 
-#include <vector>
 #include <algorithm>
+#include <cfloat>
+#include <vector>
 
 #include "Blend.H"
 #include "Bitmap.H"
 #include "Dialog.H"
 #include "Gui.H"
+#include "Histogram.H"
 #include "Inline.H"
-#include "Octree.H"
 #include "Palette.H"
 #include "Project.H"
 #include "Quantize.H"
+#include "Threads.H"
 #include "View.H"
 #include "Widget.H"
 
@@ -64,56 +66,66 @@ void Quantize::merge(color_type *c1, color_type *c2)
   c1->freq += c2->freq;  
 }
 
-// reduces color count by averaging sections of the color cube
-int Quantize::limitColors(Octree *histogram, color_type *colors, int step)
+// find the color closest to colors[index], returns the merge error
+float Quantize::nearest(color_type *colors, const int max,
+                        const int index, int *nn)
 {
-  int count = 0;
+  float least_err = FLT_MAX;
 
-  for (int b = 0; b <= 256 - step; b += step)
+  *nn = -1;
+
+  for (int i = 0; i < max; i++)
   {
-    for (int g = 0; g <= 256 - step; g += step)
+    if (i == index || colors[i].freq <= 0)
+      continue;
+
+    const float err = error(&colors[index], &colors[i]);
+
+    if (err < least_err)
     {
-      for (int r = 0; r <= 256 - step; r += step)
-      {
-        float rr = 0;
-        float gg = 0;
-        float bb = 0;
-        float div = 0;
+      least_err = err;
+      *nn = i;
+    }
+  }
 
-        for (int k = 0; k < step; k++)
-        {
-          const int bk = b + k;
-
-          for (int j = 0; j < step; j++)
-          {
-            const int gj = g + j;
-
-            for (int i = 0; i < step; i++)
-            {
-              const int ri = r + i;
-              const float d = histogram->read(ri, gj, bk);
-
-              if (d > 0)
-                histogram->write(ri, gj, bk, 0);
-
-              rr += d * ri;
-              gg += d * gj;
-              bb += d * bk;
-              div += d;
-            }
-          }
-        }
+  return least_err;
+}
 
-        if (div > 0)
-        {
-          rr /= div;
-          gg /= div;
-          bb /= div;
+// reduces color count by averaging sections of the color cube
+int Quantize::limitColors(Histogram *histogram, color_type *colors, int step)
+{
+  const int cells = 256 / step;
+  const float inc = 1.0 / histogram->total;
 
-          makeColor(&colors[count], rr, gg, bb, div);
-          count++;
-        }
-      }
+  std::vector<color_type> sum(cells * cells * cells);
+
+  for (int i = 0; i < (int)sum.size(); i++)
+    makeColor(&sum[i], 0, 0, 0, 0);
+
+  for (int i = 0; i < (int)histogram->bins.size(); i++)
+  {
+    const rgba_type rgba = getRgba(histogram->bins[i].color);
+    const float d = histogram->bins[i].count * inc;
+    color_type *c = &sum[rgba.r / step +
+                         (rgba.g / step + (rgba.b / step) * cells) * cells];
+
+    c->r += d * rgba.r;
+    c->g += d * rgba.g;
+    c->b += d * rgba.b;
+    c->freq += d;
+  }
+
+  int count = 0;
+
+  for (int i = 0; i < (int)sum.size(); i++)
+  {
+    const float div = sum[i].freq;
+
+    if (div > 0)
+    {
+      makeColor(&colors[count],
+                sum[i].r / div, sum[i].g / div, sum[i].b / div, div);
+      count++;
     }
   }
 
@@ -125,33 +137,17 @@ int Quantize::limitColors(Octree *histogram, color_type *colors, int step)
 // http://www.visgraf.impa.br/Projects/quantization/quant.html
 // http://www.visgraf.impa.br/sibgrapi97/anais/pdf/art61.pdf
 //
-void Quantize::pca(Bitmap *src, Palette *pal, int size)
+// Instead of a full error matrix, each color keeps track of its nearest
+// neighbor, so a merge costs O(n) and memory use is O(n).
+//
+int Quantize::pca(Histogram *histogram, Palette *pal, int size)
 {
-  // popularity histogram
-  Octree histogram;
-
   int max;
   int rep = size;
+  int count = histogram->bins.size();
 
-  // build histogram, inc is the weight of 1 pixel in the image
-  float inc = 1.0 / (src->cw * src->ch);
-  int count = 0;
-
-  for (int j = src->ct; j <= src->cb; j++)
-  {
-    int *p = src->row[j] + src->cl;
-
-    for (int i = src->cl; i <= src->cr; i++)
-    {
-      rgba_type rgba = getRgba(*p++);
-      float freq = histogram.read(rgba.r, rgba.g, rgba.b);
-
-      if (freq < inc)
-        count++;
-
-      histogram.write(rgba.r, rgba.g, rgba.b, freq + inc);
-    }
-  }
+  // inc is the weight of 1 pixel in the image
+  const float inc = 1.0 / histogram->total;
 
   // color list
   const int colors_max = 4096;
@@ -160,29 +156,23 @@ void Quantize::pca(Bitmap *src, Palette *pal, int size)
   for (int i = 0; i < colors_max; i++)
     colors[i].freq = 0;
 
-  // quantization error matrix
-  std::vector<float> err_data(((colors_max + 1) * colors_max) / 2);
-
   // skip if already enough colors
   if (count <= rep)
   {
     count = 0;
 
-    for (int i = 0; i < 16777216; i++)
+    for (int i = 0; i < (int)histogram->bins.size(); i++)
     {
-      rgba_type rgba = getRgba(i);
-      const float freq = histogram.read(rgba.r, rgba.g, rgba.b);
+      const rgba_type rgba = getRgba(histogram->bins[i].color);
 
-      if (freq > 0)
-      {
-        makeColor(&colors[count], rgba.r, rgba.g, rgba.b, freq);
-        count++;
-      }
+      makeColor(&colors[count], rgba.r, rgba.g, rgba.b,
+                histogram->bins[i].count * inc);
+      count++;
     }
   }
     else
   {
-    count = limitColors(&histogram, &colors[0], 16);
+    count = limitColors(histogram, &colors[0], 16);
   }
 
   // set max
@@ -190,64 +180,74 @@ void Quantize::pca(Bitmap *src, Palette *pal, int size)
   if (max < rep)
     rep = max;
 
-  // init error matrix
-  for (int j = 0; j < max; j++)
-  {
-    for (int i = 0; i < j; i++)
-      err_data[i + (j + 1) * j / 2] = error(&colors[i], &colors[j]);
-  }
+  // nearest neighbor of each color and the error of merging with it
+  std::vector<int> nn(max);
+  std::vector<float> nn_err(max);
 
-  Gui::progressShow(count - rep);
+  for (int i = 0; i < max; i++)
+    nn_err[i] = nearest(&colors[0], max, i, &nn[i]);
 
-  // measure offset between array elements
-  const int step = &(colors[1].freq) - &(colors[0].freq);
+  Gui::progressShow(count - rep);
 
   while (count > rep)
   {
-    int ii = 0, jj = 0;
-    float least_err = 999999;
-    float *a = &(colors[0].freq);
+    int ii = -1;
+    float least_err = FLT_MAX;
 
-    // find lowest value in error matrix
-    for (int j = 0; j < max; j++)
+    // find the pair with the lowest error
+    for (int i = 0; i < max; i++)
     {
-      if (*a > 0)
+      if (colors[i].freq > 0 && nn_err[i] < least_err)
       {
-        float *e = &err_data[(j + 1) * j / 2];
-        float *b = &(colors[0].freq);
-
-        for (int i = 0; i < j; i++)
-        {
-          if (*b > 0 && (*e < least_err))
-          {
-            least_err = *e;
-            ii = i;
-            jj = j;
-          }
-
-          e++;
-          b += step;
-        }
+        least_err = nn_err[i];
+        ii = i;
       }
-
-      a += step;
     }
 
+    if (ii < 0 || nn[ii] < 0)
+      break;
+
+    int jj = nn[ii];
+
+    if (jj < ii)
+      std::swap(ii, jj);
+
     // compute quantization level and place in i, delete j
     merge(&colors[ii], &colors[jj]);
-    colors[jj].freq = false;
+    colors[jj].freq = 0;
     count--;
 
-    // recompute error matrix for new row
-    for (int j = ii; j < max; j++)
+    // colors whose nearest neighbor was part of the merged pair need a
+    // full search, the rest only have to be checked against the new color
+    nn_err[ii] = nearest(&colors[0], max, ii, &nn[ii]);
+
+    for (int i = 0; i < max; i++)
     {
-      if (colors[j].freq > 0)
-        err_data[ii + (j + 1) * j / 2] = error(&colors[ii], &colors[j]);
+      if (colors[i].freq <= 0 || i == ii)
+        continue;
+
+      if (nn[i] == ii || nn[i] == jj)
+      {
+        nn_err[i] = nearest(&colors[0], max, i, &nn[i]);
+      }
+        else
+      {
+        const float err = error(&colors[i], &colors[ii]);
+
+        if (err < nn_err[i])
+        {
+          nn_err[i] = err;
+          nn[i] = ii;
+        }
+      }
     }
 
     // user cancelled operation
     if (Fl::get_key(FL_Escape))
-      return;
+    {
+      Gui::progressHide();
+      return -1;
+    }
 
     Gui::progressUpdate(count);
   }
@@ -269,5 +269,325 @@ void Quantize::pca(Bitmap *src, Palette *pal, int size)
   }
 
   pal->max = index;
+
+  return 0;
 }
 
+// Median cut quantization. The box with the largest population times
+// extent is split at the weighted median of its longest axis until there
+// are enough boxes, each box then becomes the average of its colors.
+int Quantize::medianCut(Histogram *histogram, Palette *pal, int size)
+{
+  struct box_type
+  {
+    int begin, end;
+    int axis;
+    double score;
+  };
+
+  std::vector<Histogram::bin_type> bins = histogram->bins;
+  std::vector<box_type> boxes;
+
+  // find the longest axis of a box and how worthwhile splitting it is
+  auto measure = [&](box_type *box)
+  {
+    int low[3] = { 255, 255, 255 };
+    int high[3] = { 0, 0, 0 };
+    double pop = 0;
+
+    for (int i = box->begin; i < box->end; i++)
+    {
+      const int c = bins[i].color;
+
+      for (int j = 0; j < 3; j++)
+      {
+        const int v = (c >> (j * 8)) & 255;
+
+        low[j] = std::min(low[j], v);
+        high[j] = std::max(high[j], v);
+      }
+
+      pop += bins[i].count;
+    }
+
+    box->axis = 0;
+
+    for (int j = 1; j < 3; j++)
+    {
+      if (high[j] - low[j] > high[box->axis] - low[box->axis])
+        box->axis = j;
+    }
+
+    box->score = (box->end - box->begin > 1) ?
+                   pop * (high[box->axis] - low[box->axis]) : -1;
+  };
+
+  if (!bins.empty())
+  {
+    box_type box = { 0, (int)bins.size(), 0, 0 };
+
+    measure(&box);
+    boxes.push_back(box);
+  }
+
+  Gui::progressShow(size, 1);
+
+  while ((int)boxes.size() < size)
+  {
+    int best = -1;
+
+    for (int i = 0; i < (int)boxes.size(); i++)
+    {
+      if (boxes[i].score > 0 && (best < 0 || boxes[i].score > boxes[best].score))
+        best = i;
+    }
+
+    // nothing left to split
+    if (best < 0)
+      break;
+
+    box_type *box = &boxes[best];
+    const int shift = box->axis * 8;
+
+    std::sort(bins.begin() + box->begin, bins.begin() + box->end,
+      [shift](const Histogram::bin_type &a, const Histogram::bin_type &b)
+      {
+        return ((a.color >> shift) & 255) < ((b.color >> shift) & 255);
+      });
+
+    // split at weighted median, keeping both halves occupied
+    double pop = 0;
+
+    for (int i = box->begin; i < box->end; i++)
+      pop += bins[i].count;
+
+    double sum = 0;
+    int mid = box->begin + 1;
+
+    for (int i = box->begin; i < box->end - 1; i++)
+    {
+      sum += bins[i].count;
+      mid = i + 1;
+
+      if (sum >= pop / 2)
+        break;
+    }
+
+    box_type upper = { mid, box->end, 0, 0 };
+
+    box->end = mid;
+    measure(box);
+    measure(&upper);
+    boxes.push_back(upper);
+
+    if (Gui::progressUpdate(boxes.size()) < 0)
+      return -1;
+  }
+
+  Gui::progressHide();
+
+  // build palette
+  for (int i = 0; i < (int)boxes.size(); i++)
+  {
+    double r = 0;
+    double g = 0;
+    double b = 0;
+    double div = 0;
+
+    for (int j = boxes[i].begin; j < boxes[i].end; j++)
+    {
+      const rgba_type rgba = getRgba(bins[j].color);
+      const int count = bins[j].count;
+
+      r += (double)rgba.r * count;
+      g += (double)rgba.g * count;
+      b += (double)rgba.b * count;
+      div += count;
+    }
+
+    pal->data[i] = makeRgb((int)(r / div + .5),
+                           (int)(g / div + .5),
+                           (int)(b / div + .5));
+  }
+
+  pal->max = boxes.size();
+
+  return 0;
+}
+
+// K-means (Lloyd) refinement of an existing palette. Every color in the
+// histogram is assigned to its nearest palette entry, then each entry is
+// moved to the weighted average of its colors. Threads accumulate their
+// own sums which are added afterwards.
+int Quantize::refine(Histogram *histogram, Palette *pal, int passes)
+{
+  const int size = pal->max;
+  const int count = histogram->bins.size();
+  const int threads = Threads::count();
+
+  if (size < 1 || count < 1)
+    return 0;
+
+  // palette stored as separate channels so the search can be vectorized
+  std::vector<float> pr(size);
+  std::vector<float> pg(size);
+  std::vector<float> pb(size);
+
+  for (int i = 0; i < size; i++)
+  {
+    const rgba_type rgba = getRgba(pal->data[i]);
+
+    pr[i] = rgba.r;
+    pg[i] = rgba.g;
+    pb[i] = rgba.b;
+  }
+
+  std::vector<int> assigned(count, -1);
+  std::vector<double> sums(threads * size * 4);
+  std::vector<int> changed(threads);
+
+  Gui::progressShow(passes, 1);
+
+  for (int pass = 0; pass < passes; pass++)
+  {
+    std::fill(sums.begin(), sums.end(), 0);
+    std::fill(changed.begin(), changed.end(), 0);
+
+    Threads::run(0, count - 1, [&](int band, int first, int last)
+    {
+      std::vector<float> dist(size);
+      double *sum = &sums[band * size * 4];
+
+      for (int i = first; i <= last; i++)
+      {
+        const rgba_type rgba = getRgba(histogram->bins[i].color);
+        const float r = rgba.r;
+        const float g = rgba.g;
+        const float b = rgba.b;
+
+        for (int j = 0; j < size; j++)
+        {
+          const float dr = r - pr[j];
+          const float dg = g - pg[j];
+          const float db = b - pb[j];
+
+          dist[j] = dr * dr + dg * dg + db * db;
+        }
+
+        int use = 0;
+
+        for (int j = 1; j < size; j++)
+        {
+          if (dist[j] < dist[use])
+            use = j;
+        }
+
+        if (assigned[i] != use)
+        {
+          assigned[i] = use;
+          changed[band]++;
+        }
+
+        const int freq = histogram->bins[i].count;
+        double *s = &sum[use * 4];
+
+        s[0] += r * freq;
+        s[1] += g * freq;
+        s[2] += b * freq;
+        s[3] += freq;
+      }
+    });
+
+    int total_changed = 0;
+
+    for (int i = 0; i < threads; i++)
+      total_changed += changed[i];
+
+    // move palette entries to the center of their colors
+    for (int j = 0; j < size; j++)
+    {
+      double r = 0;
+      double g = 0;
+      double b = 0;
+      double div = 0;
+
+      for (int i = 0; i < threads; i++)
+      {
+        const double *s = &sums[(i * size + j) * 4];
+
+        r += s[0];
+        g += s[1];
+        b += s[2];
+        div += s[3];
+      }
+
+      // unused entries stay where they are
+      if (div > 0)
+      {
+        pr[j] = r / div;
+        pg[j] = g / div;
+        pb[j] = b / div;
+      }
+    }
+
+    if (total_changed == 0)
+      break;
+
+    if (Gui::progressUpdate(pass) < 0)
+      return -1;
+  }
+
+  Gui::progressHide();
+
+  for (int i = 0; i < size; i++)
+  {
+    pal->data[i] = makeRgb((int)(pr[i] + .5),
+                           (int)(pg[i] + .5),
+                           (int)(pb[i] + .5));
+  }
+
+  return 0;
+}
+
+void Quantize::pca(Bitmap *src, Palette *pal, int size)
+{
+  Histogram histogram(src);
+
+  pca(&histogram, pal, size);
+}
+
+void Quantize::medianCut(Bitmap *src, Palette *pal, int size)
+{
+  Histogram histogram(src);
+
+  medianCut(&histogram, pal, size);
+}
+
+void Quantize::refine(Bitmap *src, Palette *pal, int passes)
+{
+  Histogram histogram(src);
+
+  refine(&histogram, pal, passes);
+}
+
+// create a palette using the chosen method, optionally followed by
+// k-means refinement which reuses the same histogram
+void Quantize::apply(Bitmap *src, Palette *pal, int size, int mode,
+                     bool use_refine)
+{
+  Histogram histogram(src);
+  int ret = 0;
+
+  switch (mode)
+  {
+    case PCA:
+      ret = pca(&histogram, pal, size);
+      break;
+    case MEDIAN_CUT:
+      ret = medianCut(&histogram, pal, size);
+      break;
+  }
+
+  if (ret == 0 && use_refine)
+    refine(&histogram, pal, 16);
+}
@@ -20,6 +20,7 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
 
 #include <algorithm>
 #include <cmath>
+#include <future>
 #include <vector>
 
 #include "Blend.H"
@@ -46,6 +47,53 @@ View *Render::view;
 int Render::color;
 int Render::trans;
 
+namespace
+{
+  // Marble pattern for the texture brush. It's only remade when its
+  // settings change, in the background, and tiles across the canvas.
+  // The next one is kept separate until it's done.
+  const int texture_size = 512;
+  const int texture_seed = 12345;
+
+  Map *texture_map = 0;
+  int texture_marb = -1;
+  int texture_turb = -1;
+
+  Map *texture_next = 0;
+  int texture_next_marb = -1;
+  int texture_next_turb = -1;
+  std::future<void> texture_job;
+
+  void makeTexture(Map *dest, const int marb, const int turb)
+  {
+    const int w = dest->w;
+    const int h = dest->h;
+
+    Map plasma(w, h);
+    Map marbx(w, h);
+    Map marby(w, h);
+
+    Fractal::plasma(&plasma, (turb + 1) << 10, texture_seed);
+    Fractal::plasma(&marbx, (turb + 1) << 10, texture_seed + 1);
+    Fractal::plasma(&marby, (turb + 1) << 10, texture_seed + 2);
+    Fractal::marble(&plasma, dest, &marbx, &marby, marb << 2, 100, 0);
+  }
+
+  // waits for the texture being made, if any, and makes it current
+  void finishTexture()
+  {
+    if (texture_next == 0)
+      return;
+
+    texture_job.wait();
+    delete texture_map;
+    texture_map = texture_next;
+    texture_marb = texture_next_marb;
+    texture_turb = texture_next_turb;
+    texture_next = 0;
+  }
+}
+
 // returns true if pixel is on a boundary
 bool Render::isEdge(Map *map, const int x, const int y)
 {
@@ -610,6 +658,32 @@ void Render::chalk()
   }
 }
 
+// Starts making the texture for the current brush settings in the
+// background, unless it's already made or on its way. Called when the
+// settings change, so it's usually ready by the time a stroke needs it.
+void Render::prepareTexture()
+{
+  const int marb = Project::brush->texture_marb;
+  const int turb = Project::brush->texture_turb;
+
+  if (texture_next != 0)
+  {
+    if (marb == texture_next_marb && turb == texture_next_turb)
+      return;
+
+    finishTexture();
+  }
+
+  if (marb == texture_marb && turb == texture_turb)
+    return;
+
+  texture_next = new Map(texture_size, texture_size);
+  texture_next_marb = marb;
+  texture_next_turb = turb;
+  texture_job = std::async(std::launch::async, makeTexture,
+                           texture_next, marb, turb);
+}
+
 // texture
 void Render::texture()
 {
@@ -617,20 +691,12 @@ void Render::texture()
   int j = (3 << brush->texture_edge);
   float soft_step = (float)(255 - trans) / ((j >> 1) + 1);
 
-  int w = 256;
-  int h = 256;
-
-  Map plasma(w, h);
-  Map marble(w, h);
-  Map marbx(w, h);
-  Map marby(w, h);
-
-  Fractal::plasma(&plasma, (brush->texture_turb + 1) << 10);
-  Fractal::plasma(&marbx, (brush->texture_turb + 1) << 10);
-  Fractal::plasma(&marby, (brush->texture_turb + 1) << 10);
-  Fractal::marble(&plasma, &marble, &marbx, &marby, brush->texture_marb << 2, 100, 0);
+  prepareTexture();
+  finishTexture();
 
-  Map *src = &marble;
+  Map *src = texture_map;
+  const int w = src->w;
+  const int h = src->h;
 
   if (brush->texture_edge == 0)
   {
@@ -0,0 +1,389 @@
+/*
+Copyright (c) 2024 Joe Davisson.
+
+This file is part of Rendera.
+
+Rendera is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+Rendera is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Rendera; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+*/
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <stdint.h>
+#include <vector>
+
+#include "Bitmap.H"
+#include "Gamma.H"
+#include "Gui.H"
+#include "Inline.H"
+#include "LinearBitmap.H"
+#include "Resampler.H"
+#include "Threads.H"
+
+namespace
+{
+  // source positions and weights making up each destination pixel,
+  // stored taps at a time, with edges already wrapped or clamped
+  struct axis_type
+  {
+    int taps;
+    std::vector<int> index;
+    std::vector<float> weight;
+  };
+
+  float sinc(const float x)
+  {
+    if (x == 0)
+      return 1.0f;
+
+    const float px = (float)M_PI * x;
+
+    return std::sin(px) / px;
+  }
+
+  float support(const int filter)
+  {
+    switch (filter)
+    {
+      case Resampler::BOX:
+        return 0.5f;
+      case Resampler::BILINEAR:
+        return 1.0f;
+      case Resampler::BICUBIC:
+        return 2.0f;
+      case Resampler::LANCZOS:
+        return 3.0f;
+    }
+
+    return 1.0f;
+  }
+
+  float kernel(const int filter, const float x)
+  {
+    const float ax = std::fabs(x);
+
+    switch (filter)
+    {
+      case Resampler::BOX:
+        // half-open so a pixel on the boundary is only counted once
+        return (x >= -0.5f && x < 0.5f) ? 1.0f : 0.0f;
+      case Resampler::BILINEAR:
+        return ax < 1.0f ? 1.0f - ax : 0.0f;
+      case Resampler::BICUBIC:
+        // Catmull-Rom
+        if (ax < 1.0f)
+          return (1.5f * ax - 2.5f) * ax * ax + 1.0f;
+        if (ax < 2.0f)
+          return ((-0.5f * ax + 2.5f) * ax - 4.0f) * ax + 2.0f;
+        return 0.0f;
+      case Resampler::LANCZOS:
+        return ax < 3.0f ? sinc(x) * sinc(x / 3) : 0.0f;
+    }
+
+    return 0.0f;
+  }
+
+  // Source samples may be averaged blocks, in which case the last one
+  // can be partial. extent is the true width in samples, so the last one
+  // covers extent - (src_size - 1) of a sample. Its center is moved to
+  // the middle of what it covers and its weight cut to match. Returns
+  // the position of sample j, repeated or wrapped past the edges, and
+  // sets how much of a sample it covers.
+  float samplePos(const int j, const int src_size, const float extent,
+                  const bool wrap, float *cover)
+  {
+    const int last = src_size - 1;
+    const float part = extent - last;
+
+    *cover = 1.0f;
+
+    if (j < 0)
+    {
+      if (wrap == false)
+        return j;
+
+      // wrapped from the end, which starts with the partial sample
+      if (j == -1)
+      {
+        *cover = part;
+        return -0.5f - part / 2;
+      }
+
+      return j + 1 - part;
+    }
+
+    if (j == last)
+    {
+      *cover = part;
+      return last - 0.5f + part / 2;
+    }
+
+    if (j > last)
+      return extent + (j - src_size);
+
+    return j;
+  }
+
+  // when shrinking, the kernel is stretched to cover every source pixel
+  void makeAxis(axis_type *axis, const int src_size, const float extent,
+                const int dest_size, const int filter, const bool wrap)
+  {
+    const float ratio = extent / dest_size;
+    const float stretch = std::max(ratio, 1.0f);
+    const float radius = support(filter) * stretch;
+
+    // positions past a partial sample are shifted, so look one further
+    const int pad = extent < src_size ? 1 : 0;
+    const int taps = (int)std::ceil(radius * 2) + 1 + pad * 2;
+
+    axis->taps = taps;
+    axis->index.resize(dest_size * taps);
+    axis->weight.resize(dest_size * taps);
+
+    for (int i = 0; i < dest_size; i++)
+    {
+      // pixel centers line up, rather than top-left corners
+      const float center = (i + 0.5f) * ratio - 0.5f;
+      const int first = (int)std::floor(center - radius) - pad;
+      int *index = &axis->index[i * taps];
+      float *weight = &axis->weight[i * taps];
+      float total = 0;
+
+      for (int t = 0; t < taps; t++)
+      {
+        int j = first + t;
+        float cover;
+        const float pos = samplePos(j, src_size, extent, wrap, &cover);
+
+        weight[t] = kernel(filter, (pos - center) / stretch) * cover;
+        total += weight[t];
+
+        if (wrap)
+          j = ((j % src_size) + src_size) % src_size;
+        else
+          j = std::min(std::max(j, 0), src_size - 1);
+
+        index[t] = j;
+      }
+
+      if (total == 0)
+      {
+        const int nearest = (int)std::floor(center + 0.5f) - first;
+
+        weight[std::min(std::max(nearest, 0), taps - 1)] = 1.0f;
+        total = 1.0f;
+      }
+
+      for (int t = 0; t < taps; t++)
+        weight[t] /= total;
+    }
+  }
+
+  // calls func(first, last) on rows split across threads, a batch at a
+  // time, returns -1 if cancelled
+  int runRows(const int rows, const int done, const bool show_progress,
+              std::function<void (int, int)> func)
+  {
+    const int batch = 256;
+
+    for (int y1 = 0; y1 < rows; y1 += batch)
+    {
+      const int y2 = std::min(y1 + batch - 1, rows - 1);
+
+      Threads::run(y1, y2, [&](int, int first, int last)
+      {
+        func(first, last);
+      });
+
+      if (show_progress)
+      {
+        for (int y = y1; y <= y2; y++)
+        {
+          if (Gui::progressUpdate(done + y) < 0)
+            return -1;
+        }
+      }
+    }
+
+    return 0;
+  }
+}
+
+// Resamples the clipping area of src to fill dest, returns -1 if
+// cancelled. Large reductions first average whole blocks of source
+// pixels, reading each one once, so the filter is left with less than
+// a 4:1 reduction to cover.
+int Resampler::apply(Bitmap *src, Bitmap *dest, const int filter,
+                     const bool wrap, const bool show_progress)
+{
+  const int sw = src->cw;
+  const int sh = src->ch;
+  const int dw = dest->w;
+  const int dh = dest->h;
+
+  // block size and size of the averaged image
+  const int kx = std::max(1, sw / (dw * 2));
+  const int ky = std::max(1, sh / (dh * 2));
+  const int rw = (sw + kx - 1) / kx;
+  const int rh = (sh + ky - 1) / ky;
+
+  axis_type axis_x, axis_y;
+
+  makeAxis(&axis_x, rw, (float)sw / kx, dw, filter, wrap);
+  makeAxis(&axis_y, rh, (float)sh / ky, dh, filter, wrap);
+
+  LinearBitmap temp(dw, rh);
+
+  if (show_progress)
+    Gui::progressShow(rh + dh);
+
+  // horizontal pass, averaged source rows to intermediate rows
+  int result = runRows(rh, 0, show_progress, [&](int first, int last)
+  {
+    const int taps = axis_x.taps;
+    std::vector<int64_t> block(rw * 4);
+    std::vector<int> line(rw * 4);
+
+    for (int y = first; y <= last; y++)
+    {
+      const int y1 = y * ky;
+      const int y2 = std::min(y1 + ky, sh);
+
+      std::fill(block.begin(), block.end(), 0);
+
+      for (int yy = y1; yy < y2; yy++)
+      {
+        const int *s = src->row[src->ct + yy] + src->cl;
+        int x = 0;
+
+        for (int i = 0; i < rw; i++)
+        {
+          const int end = std::min(x + kx, sw);
+
+          for (; x < end; x++)
+          {
+            const rgba_type rgba = getRgba(s[x]);
+
+            block[i] += Gamma::fix(rgba.r) * rgba.a;
+            block[i + rw] += Gamma::fix(rgba.g) * rgba.a;
+            block[i + rw * 2] += Gamma::fix(rgba.b) * rgba.a;
+            block[i + rw * 3] += rgba.a * 257;
+          }
+        }
+      }
+
+      for (int i = 0; i < rw; i++)
+      {
+        const int count = std::min(kx, sw - i * kx) * (y2 - y1);
+
+        // colors are premultiplied by alpha
+        for (int c = 0; c < 3; c++)
+        {
+          const int j = i + c * rw;
+
+          line[j] = (block[j] + count * 127) / (count * 255);
+        }
+
+        const int j = i + rw * 3;
+
+        line[j] = (block[j] + count / 2) / count;
+      }
+
+      for (int c = 0; c < 4; c++)
+      {
+        const int *in = &line[c * rw];
+        uint16_t *out = &temp.plane[c][y * dw];
+
+        for (int x = 0; x < dw; x++)
+        {
+          const int *index = &axis_x.index[x * taps];
+          const float *weight = &axis_x.weight[x * taps];
+          float sum = 0;
+
+          for (int t = 0; t < taps; t++)
+            sum += in[index[t]] * weight[t];
+
+          out[x] = clamp((int)(sum + 0.5f), 65535);
+        }
+      }
+    }
+  });
+
+  if (result < 0)
+    return -1;
+
+  // vertical pass, whole intermediate rows at a time
+  result = runRows(dh, rh, show_progress, [&](int first, int last)
+  {
+    const int taps = axis_y.taps;
+    std::vector<float> sum(dw * 4);
+
+    for (int y = first; y <= last; y++)
+    {
+      const int *index = &axis_y.index[y * taps];
+      const float *weight = &axis_y.weight[y * taps];
+
+      std::fill(sum.begin(), sum.end(), 0.0f);
+
+      for (int c = 0; c < 4; c++)
+      {
+        float *acc = &sum[c * dw];
+
+        for (int t = 0; t < taps; t++)
+        {
+          const uint16_t *in = &temp.plane[c][index[t] * dw];
+          const float w = weight[t];
+
+          if (w == 0)
+            continue;
+
+          for (int x = 0; x < dw; x++)
+            acc[x] += in[x] * w;
+        }
+      }
+
+      int *d = dest->row[y];
+
+      for (int x = 0; x < dw; x++)
+      {
+        const float alpha = sum[x + dw * 3];
+
+        if (alpha < 0.5f)
+        {
+          d[x] = 0;
+          continue;
+        }
+
+        // undo the premultiply
+        const float scale = 65535 / alpha;
+        const int r = clamp((int)(sum[x] * scale + 0.5f), 65535);
+        const int g = clamp((int)(sum[x + dw] * scale + 0.5f), 65535);
+        const int b = clamp((int)(sum[x + dw * 2] * scale + 0.5f), 65535);
+        const int a = clamp((int)(alpha + 0.5f), 65535);
+
+        d[x] = makeRgba(Gamma::unfix(r), Gamma::unfix(g), Gamma::unfix(b),
+                        (a + 128) / 257);
+      }
+    }
+  });
+
+  if (result < 0)
+    return -1;
+
+  if (show_progress)
+    Gui::progressHide();
+
+  return 0;
+}
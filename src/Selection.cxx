@@ -587,3 +587,10 @@ void Selection::reload()
   Gui::selectCropEnable(false);
 }
 
+// moves the floating selection, call reload() afterwards
+void Selection::shift(const int x, const int y)
+{
+  beginx += x;
+  beginy += y;
+}
+
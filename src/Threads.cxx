@@ -0,0 +1,65 @@
+/*
+Copyright (c) 2024 Joe Davisson.
+
+This file is part of Rendera.
+
+Rendera is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+Rendera is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Rendera; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+*/
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+#include "Threads.H"
+
+// number of worker threads to use
+int Threads::count()
+{
+  static const int threads =
+    std::max(1, (int)std::thread::hardware_concurrency());
+
+  return threads;
+}
+
+// splits the range first-last (inclusive) into bands and calls
+// func(band, band_first, band_last) for each one in its own thread,
+// band 0 runs on the calling thread
+//
+// func must not call FLTK or update the progress bar, process large
+// images in batches and update it between calls instead
+void Threads::run(const int first, const int last,
+                  std::function<void (int, int, int)> func)
+{
+  const int size = last - first + 1;
+
+  if (size <= 0)
+    return;
+
+  const int bands = std::min(count(), size);
+  std::vector<std::thread> threads;
+
+  for (int i = 1; i < bands; i++)
+  {
+    threads.push_back(std::thread(func, i,
+                                  first + size * i / bands,
+                                  first + size * (i + 1) / bands - 1));
+  }
+
+  func(0, first, first + size / bands - 1);
+
+  for (int i = 0; i < (int)threads.size(); i++)
+    threads[i].join();
+}
+
@@ -23,6 +23,7 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
 
 #include <FL/Fl_Choice.H>
 
+#include "Affine.H"
 #include "Bitmap.H"
 #include "CheckBox.H"
 #include "Dialog.H"
@@ -34,13 +35,13 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
 #include "InputInt.H"
 #include "Map.H"
 #include "Project.H"
+#include "Resampler.H"
+#include "Selection.H"
 #include "Separator.H"
 #include "Transform.H"
 #include "Undo.H"
 #include "View.H"
 
-#include "FX/GaussianBlur.H"
-
 namespace
 {
   Bitmap *bmp;
@@ -187,29 +188,6 @@ namespace Scale
     Fl_Button *cancel;
   }
 
-  void do_blur(Bitmap *bmp, float size)
-  {
-    GaussianBlur::apply(bmp, size / 2, 0, 0);
-  }
-
-  float cubic(const float p[4], const float x)
-  {
-    return p[1] + 0.5f * x * (p[2] - p[0] + x * (2.0f * p[0] - 5.0f * p[1]
-           + 4.0f * p[2] - p[3] + x * (3.0f * (p[1] - p[2]) + p[3] - p[0])));
-  }
-
-  float bicubic(const float p[4][4], const float x, const float y)
-  {
-    float temp[4];
-
-    temp[0] = cubic(p[0], y);
-    temp[1] = cubic(p[1], y);
-    temp[2] = cubic(p[2], y);
-    temp[3] = cubic(p[3], y);
-
-    return cubic(temp, x);
-  }
-
   void apply(const int dw, const int dh, const bool wrap_edges)
   {
     Bitmap *bmp = Project::bmp;
@@ -235,21 +213,6 @@ namespace Scale
     const float ax = ((float)sw / dw);
     const float ay = ((float)sh / dh);
 
-    float mipx = 0, mipy = 0;
-    bool blur = false;
-    float blur_size = 0;
-
-    if (sw > dw)
-      mipx = (sw / dw);
-    if (sh > dh)
-      mipy = (sh / dh);
-
-    if (mipx > .5 || mipy > .5)
-    {
-      blur_size = mipx > mipy ? mipx : mipy;
-      blur = true;
-    }
-
    if (Items::mode->value() == 0)
     {
       // nearest
@@ -266,168 +229,21 @@ namespace Scale
         }
       }
     }
-    else if (Items::mode->value() == 1)
+    else
     {
-      // bilinear
-      if (blur)
-        do_blur(bmp, blur_size);
-
-      Gui::progressShow(dh);
-
-      for (int y = 0; y < dh; y++) 
+      const int filters[] =
       {
-        int *d = temp->row[dy + y] + dx;
-        const float vv = (y * ay);
-        const int v1 = vv;
-        const float v = vv - v1;
-
-        if (sy + v1 >= bmp->h - 1)
-          break;
-
-        int v2 = v1 + 1;
-
-        if (v2 >= sh)
-        {
-          if (wrap_edges)
-            v2 -= sh;
-          else
-            v2--;
-        }
-
-        int *c[4];
-        c[0] = c[1] = bmp->row[sy + v1] + sx;
-        c[2] = c[3] = bmp->row[sy + v2] + sx;
-
-        for (int x = 0; x < dw; x++) 
-        {
-          const float uu = (x * ax);
-          const int u1 = uu;
-          const float u = uu - u1;
-
-          if (sx + u1 >= bmp->w - 1)
-            break;
-
-          int u2 = u1 + 1;
-
-          if (u2 >= sw)
-          {
-            if (wrap_edges)
-              u2 -= sw;
-            else
-              u2--;
-          }
-
-          c[0] += u1;
-          c[1] += u2;
-          c[2] += u1;
-          c[3] += u2;
-
-          float f[4];
-
-          f[0] = (1.0f - u) * (1.0f - v);
-          f[1] = u * (1.0f - v);
-          f[2] = (1.0f - u) * v;
-          f[3] = u * v;
-
-          float r = 0, g = 0, b = 0, a = 0;
-
-          for (int i = 0; i < 4; i++)
-          {
-            rgba_type rgba = getRgba(*c[i]);
-            r += (float)Gamma::fix(rgba.r) * f[i];
-            g += (float)Gamma::fix(rgba.g) * f[i];
-            b += (float)Gamma::fix(rgba.b) * f[i];
-            a += rgba.a * f[i];
-          }
-
-          r = Gamma::unfix((int)r);
-          g = Gamma::unfix((int)g);
-          b = Gamma::unfix((int)b);
-
-          *d++ = makeRgba((int)r, (int)g, (int)b, (int)a);
-
-          c[0] -= u1;
-          c[1] -= u2;
-          c[2] -= u1;
-          c[3] -= u2;
-        }
-
-        if (Gui::progressUpdate(y) < 0)
-          break;
-      }
-    }
-    else if (Items::mode->value() == 2)
-    {
-      if (blur)
-        do_blur(bmp, blur_size);
-
-      // bicubic
-      float r[4][4];
-      float g[4][4];
-      float b[4][4];
-      float a[4][4];
-
-      Gui::progressShow(dh);
-
-      for (int y = 0; y < dh; y++) 
+        Resampler::BOX,
+        Resampler::BILINEAR,
+        Resampler::BICUBIC,
+        Resampler::LANCZOS
+      };
+
+      if (Resampler::apply(bmp, temp, filters[Items::mode->value() - 1],
+                           wrap_edges, true) < 0)
       {
-        int *d = temp->row[dy + y] + dx;
-
-        const float vv = (y * ay);
-        const int v1 = vv;
-        const float v = vv - v1;
-
-        for (int x = 0; x < dw; x++) 
-        {
-          const float uu = (x * ax);
-          const int u1 = uu;
-          const float u = uu - u1;
-
-          for (int j = 0; j < 4; j++)
-          {
-            int yy = v1 + j - 1;
-
-            if (wrap_edges)
-            {
-              if (yy >= sh)
-                yy -= sh;
-            }
-
-            if (yy > sh - 1)
-              yy = sh - 1;
-
-            for (int i = 0; i < 4; i++)
-            {
-              int xx = u1 + i - 1;
-
-              if (wrap_edges)
-              {
-                if (xx >= sw)
-                  xx -= sw;
-              }
-
-              if (xx > sw - 1)
-                xx = sw - 1;
-
-              rgba_type rgba = getRgba(bmp->getpixel(sx + xx, sy + yy));
-
-              r[i][j] = Gamma::fix(rgba.r);
-              g[i][j] = Gamma::fix(rgba.g);
-              b[i][j] = Gamma::fix(rgba.b);
-              a[i][j] = Gamma::fix(rgba.a);
-            }
-          }
-
-          const int rr = Gamma::unfix(clamp(bicubic(r, u, v), 65535));
-          const int gg = Gamma::unfix(clamp(bicubic(g, u, v), 65535));
-          const int bb = Gamma::unfix(clamp(bicubic(b, u, v), 65535));
-          const int aa = Gamma::unfix(clamp(bicubic(a, u, v), 65535));
-
-          *d++ = makeRgba(rr, gg, bb, aa);
-        }
-
-        if (Gui::progressUpdate(y) < 0)
-          break;
+        delete temp;
+        return;
       }
     }
 
@@ -549,9 +365,11 @@ namespace Scale
     Items::mode->labelsize(12);
     Items::mode->textsize(12);
     Items::mode->add("Nearest");
+    Items::mode->add("Box");
     Items::mode->add("Bilinear");
     Items::mode->add("Bicubic");
-    Items::mode->value(2);
+    Items::mode->add("Lanczos");
+    Items::mode->value(3);
     Items::mode->align(FL_ALIGN_LEFT);
     Items::mode->measure_label(ww, hh);
     Items::mode->resize(Items::dialog->x() + Items::dialog->w() / 2 - (Items::mode->w() + ww) / 2 + ww, Items::mode->y(), Items::mode->w(), Items::mode->h());
@@ -575,133 +393,44 @@ namespace RotateArbitrary
     DialogWindow *dialog;
     InputFloat *angle;
     InputFloat *scale;
+    Fl_Choice *mode;
     Fl_Button *ok;
     Fl_Button *cancel;
   }
 
-  void apply(double angle, double scale)
+  void apply(const double angle, const double scale, const int filter)
   {
     Bitmap *bmp = Project::bmp;
+    Affine affine;
 
-    // angle correction
-    angle += 90;
-
-    // rotation
-    int du_col = (int)((std::sin(angle * (M_PI / 180)) * scale) * 65536);
-    int dv_col = (int)((std::sin((angle + 90) * (M_PI / 180)) * scale) * 65536);
-    int du_row = -dv_col;
-    int dv_row = du_col;
-
-    const int ww = (bmp->cr - bmp->cl) / 2;
-    const int hh = (bmp->cb - bmp->ct) / 2;
-
-    const int xx = bmp->cl;
-    const int yy = bmp->ct;
-
-    // origin
-    const int ox = xx + ww;
-    const int oy = yy + hh;
-        
-    // project new corners
-    int x0 = xx - ox;
-    int y0 = yy - oy;
-    int x1 = xx + (ww * 2) - ox;
-    int y1 = yy - oy;
-    int x2 = xx - ox;
-    int y2 = yy + (hh * 2) - oy;
-    int x3 = xx + (ww * 2) - ox;
-    int y3 = yy + (hh * 2) - oy;
-
-    const int oldx0 = x0;
-    const int oldy0 = y0;
-    const int oldx1 = x1;
-    const int oldy1 = y1;
-    const int oldx2 = x2;
-    const int oldy2 = y2;
-    const int oldx3 = x3;
-    const int oldy3 = y3;
-
-    // rotate
-    x0 = xx + ((oldx0 * du_col + oldy0 * du_row) >> 16);
-    y0 = yy + ((oldx0 * dv_col + oldy0 * dv_row) >> 16);
-    x1 = xx + ((oldx1 * du_col + oldy1 * du_row) >> 16);
-    y1 = yy + ((oldx1 * dv_col + oldy1 * dv_row) >> 16);
-    x2 = xx + ((oldx2 * du_col + oldy2 * du_row) >> 16);
-    y2 = yy + ((oldx2 * dv_col + oldy2 * dv_row) >> 16);
-    x3 = xx + ((oldx3 * du_col + oldy3 * du_row) >> 16);
-    y3 = yy + ((oldx3 * dv_col + oldy3 * dv_row) >> 16);
+    // turn around the center of the image
+    affine.translate(-(bmp->cl + bmp->cw / 2.0), -(bmp->ct + bmp->ch / 2.0));
+    affine.rotate(angle);
+    affine.scale(scale, scale);
 
     // find new bounding box
-    const int bx1 = std::min(x0, std::min(x1, std::min(x2, x3))) - scale * 2;
-    const int by1 = std::min(y0, std::min(y1, std::min(y2, y3))) - scale * 2;
-    const int bx2 = std::max(x0, std::max(x1, std::max(x2, x3))) + scale * 2;
-    const int by2 = std::max(y0, std::max(y1, std::max(y2, y3))) + scale * 2;
-    int bw = (bx2 - bx1) + 1;
-    int bh = (by2 - by1) + 1;
+    int bx1, by1, bx2, by2;
+
+    affine.bounds(bmp->cl, bmp->ct, bmp->cr + 1, bmp->cb + 1,
+                  &bx1, &by1, &bx2, &by2);
+
+    const int bw = bx2 - bx1 + 1;
+    const int bh = by2 - by1 + 1;
 
     // check memory
     if (Project::enoughMemory(bw, bh) == false)
       return;
 
-    // create image with new size
-    Bitmap *temp = new Bitmap(bw, bh);
-    temp->rectfill(temp->cl, temp->ct, temp->cr, temp->cb,
-                   makeRgba(0, 0, 0, 0), 0);
-
-    bw /= 2;
-    bh /= 2;
+    affine.translate(-bx1, -by1);
 
-    // rotation
-    du_col = (int)((std::sin(angle * (M_PI / 180)) / scale) * 65536);
-    dv_col = (int)((std::sin((angle + 90) * (M_PI / 180)) / scale) * 65536);
-    du_row = -dv_col;
-    dv_row = du_col;
-
-    int row_u = (bmp->w / 2) << 16;
-    int row_v = (bmp->h / 2) << 16;
-
-    row_u -= bw * du_col + bh * du_row;
-    row_v -= bw * dv_col + bh * dv_row;
-
-    Gui::progressShow(by2 - by1);
+    Bitmap *temp = new Bitmap(bw, bh);
 
-    // draw image
-    for (int y = by1; y <= by2; y++)
+    if (affine.apply(bmp, temp, filter, true) < 0)
     {
-      int u = row_u;
-      int v = row_v;
-
-      row_u += du_row;
-      row_v += dv_row;
-
-      const int ty = ((temp->ch) / 2) + y;
-
-      if (ty < temp->ct || ty > temp->cb)
-        continue;
-
-      for (int x = bx1; x <= bx2; x++)
-      {
-        int uu = u >> 16;
-        int vv = v >> 16;
-
-        u += du_col;
-        v += dv_col;
-
-        if (uu < bmp->cl || uu > bmp->cr || vv < bmp->ct || vv > bmp->cb)
-          continue;
-
-        const int tx = ((temp->cw) / 2) + x;
-        if (tx < temp->cl || tx > temp->cr)
-          continue;
-
-        const int c = *(bmp->row[vv] + uu);
-        *(temp->row[ty] + tx) = c;
-      }
-
-      Gui::progressUpdate(y - by1);
+      delete temp;
+      return;
     }
 
-    Gui::progressHide();
     Project::replaceImageFromBitmap(temp);
 
     Gui::getView()->ox = 0;
@@ -720,7 +449,15 @@ namespace RotateArbitrary
     Items::dialog->hide();
     pushUndo();
 
-    apply(atof(Items::angle->value()), atof(Items::scale->value()));
+    const int filters[] =
+    {
+      Affine::NEAREST,
+      Affine::BILINEAR,
+      Affine::BICUBIC
+    };
+
+    apply(atof(Items::angle->value()), atof(Items::scale->value()),
+          filters[Items::mode->value()]);
   }
 
   void quit()
@@ -731,6 +468,8 @@ namespace RotateArbitrary
   void init()
   {
     int y1 = 8;
+    int ww = 0;
+    int hh = 0;
 
     Items::dialog = new DialogWindow(256, 0, "Arbitrary Rotation");
     Items::angle = new InputFloat(Items::dialog, 0, y1, 128, 24, "Angle", 0, -359.99, 359.99);
@@ -741,6 +480,184 @@ namespace RotateArbitrary
     Items::scale->center();
     Items::scale->value("1.000");
     y1 += 24 + 8;
+    Items::mode = new Fl_Choice(0, y1, 96, 24, "Mode:");
+    Items::mode->labelsize(12);
+    Items::mode->textsize(12);
+    Items::mode->add("Nearest");
+    Items::mode->add("Bilinear");
+    Items::mode->add("Bicubic");
+    Items::mode->value(2);
+    Items::mode->align(FL_ALIGN_LEFT);
+    Items::mode->measure_label(ww, hh);
+    Items::mode->resize(Items::dialog->x() + Items::dialog->w() / 2 - (Items::mode->w() + ww) / 2 + ww, Items::mode->y(), Items::mode->w(), Items::mode->h());
+    y1 += 24 + 8;
+    Items::dialog->addOkCancelButtons(&Items::ok, &Items::cancel, &y1);
+    Items::ok->callback((Fl_Callback *)close);
+    Items::cancel->callback((Fl_Callback *)quit);
+    Items::dialog->set_modal();
+    Items::dialog->end(); 
+  }
+}
+
+namespace FreeTransform
+{
+  namespace Items
+  {
+    DialogWindow *dialog;
+    InputFloat *width;
+    InputFloat *height;
+    InputFloat *angle;
+    CheckBox *flip_x;
+    CheckBox *flip_y;
+    InputInt *move_x;
+    InputInt *move_y;
+    Fl_Choice *mode;
+    Fl_Button *ok;
+    Fl_Button *cancel;
+  }
+
+  // floating selection instead of the image
+  bool selection = false;
+
+  void begin(const bool use_selection)
+  {
+    selection = use_selection;
+
+    Items::width->value("100");
+    Items::height->value("100");
+    Items::angle->value("0");
+    Items::flip_x->value(0);
+    Items::flip_y->value(0);
+    Items::move_x->value("0");
+    Items::move_y->value("0");
+
+    // moving only means something for the selection
+    if (selection)
+    {
+      Items::move_x->activate();
+      Items::move_y->activate();
+    }
+    else
+    {
+      Items::move_x->deactivate();
+      Items::move_y->deactivate();
+    }
+
+    Items::dialog->show();
+  }
+
+  void close()
+  {
+    Bitmap *src = selection ? Project::select_bmp : Project::bmp;
+    const double cx = src->cl + src->cw / 2.0;
+    const double cy = src->ct + src->ch / 2.0;
+    const double sx = atof(Items::width->value()) / 100;
+    const double sy = atof(Items::height->value()) / 100;
+    Affine affine;
+
+    // scale, flip and turn around the center, then move, all as a
+    // single transform so the image is only resampled once
+    affine.translate(-cx, -cy);
+    affine.scale(Items::flip_x->value() ? -sx : sx,
+                 Items::flip_y->value() ? -sy : sy);
+    affine.rotate(atof(Items::angle->value()));
+    affine.translate(cx + atoi(Items::move_x->value()),
+                     cy + atoi(Items::move_y->value()));
+
+    int bx1, by1, bx2, by2;
+
+    affine.bounds(src->cl, src->ct, src->cr + 1, src->cb + 1,
+                  &bx1, &by1, &bx2, &by2);
+
+    const int bw = bx2 - bx1 + 1;
+    const int bh = by2 - by1 + 1;
+
+    if (Project::enoughMemory(bw, bh) == false)
+      return;
+
+    Items::dialog->hide();
+
+    if (selection == false)
+      pushUndo();
+
+    const int filters[] =
+    {
+      Affine::NEAREST,
+      Affine::BILINEAR,
+      Affine::BICUBIC
+    };
+
+    affine.translate(-bx1, -by1);
+
+    Bitmap *temp = new Bitmap(bw, bh);
+
+    if (affine.apply(src, temp, filters[Items::mode->value()], true) < 0)
+    {
+      delete temp;
+      return;
+    }
+
+    if (selection)
+    {
+      delete Project::select_bmp;
+      Project::select_bmp = temp;
+      Project::selection->shift(bx1, by1);
+      Project::selection->reload();
+    }
+    else
+    {
+      Project::replaceImageFromBitmap(temp);
+      Gui::getView()->ox = 0;
+      Gui::getView()->oy = 0;
+    }
+
+    Gui::getView()->drawMain(true);
+  }
+
+  void quit()
+  {
+    Items::dialog->hide();
+  }
+
+  void init()
+  {
+    int y1 = 8;
+    int ww = 0;
+    int hh = 0;
+
+    Items::dialog = new DialogWindow(256, 0, "Transform");
+    Items::width = new InputFloat(Items::dialog, 0, y1, 96, 24, "Width %", 0, 1, 1000);
+    Items::width->center();
+    y1 += 24 + 8;
+    Items::height = new InputFloat(Items::dialog, 0, y1, 96, 24, "Height %", 0, 1, 1000);
+    Items::height->center();
+    y1 += 24 + 8;
+    Items::angle = new InputFloat(Items::dialog, 0, y1, 128, 24, "Angle", 0, -359.99, 359.99);
+    Items::angle->center();
+    y1 += 24 + 8;
+    Items::flip_x = new CheckBox(Items::dialog, 0, y1, 16, 16, "Flip Horizontal", 0);
+    Items::flip_x->center();
+    y1 += 16 + 8;
+    Items::flip_y = new CheckBox(Items::dialog, 0, y1, 16, 16, "Flip Vertical", 0);
+    Items::flip_y->center();
+    y1 += 16 + 8;
+    Items::move_x = new InputInt(Items::dialog, 0, y1, 96, 24, "Move X", 0, -32768, 32768);
+    Items::move_x->center();
+    y1 += 24 + 8;
+    Items::move_y = new InputInt(Items::dialog, 0, y1, 96, 24, "Move Y", 0, -32768, 32768);
+    Items::move_y->center();
+    y1 += 24 + 8;
+    Items::mode = new Fl_Choice(0, y1, 96, 24, "Mode:");
+    Items::mode->labelsize(12);
+    Items::mode->textsize(12);
+    Items::mode->add("Nearest");
+    Items::mode->add("Bilinear");
+    Items::mode->add("Bicubic");
+    Items::mode->value(2);
+    Items::mode->align(FL_ALIGN_LEFT);
+    Items::mode->measure_label(ww, hh);
+    Items::mode->resize(Items::dialog->x() + Items::dialog->w() / 2 - (Items::mode->w() + ww) / 2 + ww, Items::mode->y(), Items::mode->w(), Items::mode->h());
+    y1 += 24 + 8;
     Items::dialog->addOkCancelButtons(&Items::ok, &Items::cancel, &y1);
     Items::ok->callback((Fl_Callback *)close);
     Items::cancel->callback((Fl_Callback *)quit);
@@ -754,6 +671,7 @@ void Transform::init()
   Resize::init();
   Scale::init();
   RotateArbitrary::init();
+  FreeTransform::init();
 }
 
 void Transform::flipHorizontal()
@@ -785,30 +703,28 @@ void Transform::rotateArbitrary()
   RotateArbitrary::begin();
 }
 
-void Transform::rotate90()
+void Transform::transform()
 {
-  pushUndo();
+  FreeTransform::begin(false);
+}
 
-  int w = Project::bmp->w;
-  int h = Project::bmp->h;
+void Transform::transformSelection()
+{
+  FreeTransform::begin(true);
+}
 
-  // make copy
-  Bitmap temp(w, h);
-  Project::bmp->blit(&temp, 0, 0, 0, 0, w, h);
+void Transform::rotate90()
+{
+  Bitmap *bmp = Project::bmp;
 
-  // create rotated image
-  delete Project::bmp;
-  Project::bmp = new Bitmap(h, w);
+  if (Project::enoughMemory(bmp->h, bmp->w) == false)
+    return;
 
-  int *p = &temp.data[0];
+  pushUndo();
 
-  for (int y = 0; y < h; y++)
-  {
-    for (int x = 0; x < w; x++)
-    {
-       *(Project::bmp->row[x] + h - 1 - y) = *p++;   
-    } 
-  } 
+  Bitmap *temp = new Bitmap(bmp->h, bmp->w);
+  bmp->rotate90(temp);
+  Project::replaceImageFromBitmap(temp);
 
   Gui::getView()->drawMain(true);
 }